@@ -165,6 +165,12 @@ struct fat_file_struct
     struct fat_dir_entry_struct dir_entry;
     offset_t pos;
     cluster_t pos_cluster;
+#if FAT_RUN_MAX
+    /* run of consecutive clusters found last, and the cluster after it */
+    cluster_t run_start;
+    cluster_t run_end;
+    cluster_t run_next;
+#endif
 };
 
 struct fat_dir_struct
@@ -198,8 +204,13 @@ static struct fat_dir_struct fat_dir_handles[FAT_DIR_COUNT];
 #endif
 
 static uint8_t fat_read_header(struct fat_fs_struct* fs);
+static uint8_t fat_read_entry(const struct fat_fs_struct* fs, offset_t offset, uint8_t* entry, uint8_t length);
+#if FAT_WRITE_SUPPORT
+static uint8_t fat_write_entry(const struct fat_fs_struct* fs, offset_t offset, const uint8_t* entry, uint8_t length);
+#endif
 static cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num);
 static offset_t fat_cluster_offset(const struct fat_fs_struct* fs, cluster_t cluster_num);
+static cluster_t fat_file_next_cluster(struct fat_file_struct* fd, cluster_t cluster_num);
 static uint8_t fat_dir_entry_read_callback(uint8_t* buffer, offset_t offset, void* p);
 #if FAT_LFN_SUPPORT
 static uint8_t fat_calc_83_checksum(const uint8_t* file_name_83);
@@ -423,6 +434,84 @@ uint8_t fat_read_header(struct fat_fs_struct* fs)
     return 1;
 }
 
+/**
+ * \ingroup fat_file
+ * Retrieves the next following cluster of a file.
+ *
+ * The first time a cluster outside the known run is asked for, the FAT
+ * is followed from it as long as the clusters are consecutive, up to
+ * FAT_RUN_MAX of them. Within that run no FAT access is needed.
+ *
+ * \param[in] fd The file the cluster belongs to.
+ * \param[in] cluster_num The number of the cluster for which to determine its successor.
+ * \returns The wanted cluster number, or 0 on error or at the end of the file.
+ */
+cluster_t fat_file_next_cluster(struct fat_file_struct* fd, cluster_t cluster_num)
+{
+#if FAT_RUN_MAX
+    if(cluster_num < fd->run_start || cluster_num > fd->run_end)
+    {
+        cluster_t cluster_next;
+
+        fd->run_start = fd->run_end = cluster_num;
+        while((cluster_next = fat_get_next_cluster(fd->fs, fd->run_end)) == fd->run_end + 1 &&
+              fd->run_end - fd->run_start < FAT_RUN_MAX - 1)
+            fd->run_end = cluster_next;
+        fd->run_next = cluster_next;
+    }
+
+    if(cluster_num < fd->run_end)
+        return cluster_num + 1;
+    return fd->run_next;
+#else
+    return fat_get_next_cluster(fd->fs, cluster_num);
+#endif
+}
+
+/**
+ * \ingroup fat_fs
+ * Reads an entry of the file allocation table.
+ *
+ * The device is told the access is for metadata, so it can keep
+ * the table cached apart from file data.
+ *
+ * \param[in] fs The filesystem the table belongs to.
+ * \param[in] offset The offset of the entry on the device.
+ * \param[out] entry The buffer into which to read the entry.
+ * \param[in] length The size of the entry.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t fat_read_entry(const struct fat_fs_struct* fs, offset_t offset, uint8_t* entry, uint8_t length)
+{
+    uint8_t hint = fat_device_hint(1);
+    uint8_t result = fs->partition->device_read(offset, entry, length);
+    fat_device_hint(hint);
+
+    return result;
+}
+
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_fs
+ * Writes an entry of the file allocation table.
+ *
+ * \param[in] fs The filesystem the table belongs to.
+ * \param[in] offset The offset of the entry on the device.
+ * \param[in] entry The entry to write.
+ * \param[in] length The size of the entry.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_read_entry
+ */
+uint8_t fat_write_entry(const struct fat_fs_struct* fs, offset_t offset, const uint8_t* entry, uint8_t length)
+{
+    uint8_t hint = fat_device_hint(1);
+    uint8_t result = fs->partition->device_write(offset, entry, length);
+    fat_device_hint(hint);
+
+    return result;
+}
+#endif
+
 /**
  * \ingroup fat_fs
  * Retrieves the next following cluster of a given cluster.
@@ -445,7 +534,7 @@ cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster
     {
         /* read appropriate fat entry */
         uint32_t fat_entry;
-        if(!fs->partition->device_read(fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+        if(!fat_read_entry(fs, fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
             return 0;
 
         /* determine next cluster from fat */
@@ -462,7 +551,7 @@ cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster
     {
         /* read appropriate fat entry */
         uint16_t fat_entry;
-        if(!fs->partition->device_read(fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+        if(!fat_read_entry(fs, fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
             return 0;
 
         /* determine next cluster from fat */
@@ -495,8 +584,6 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
     if(!fs)
         return 0;
 
-    device_read_t device_read = fs->partition->device_read;
-    device_write_t device_write = fs->partition->device_write;
     offset_t fat_offset = fs->header.fat_offset;
     cluster_t count_left = count;
     cluster_t cluster_current = fs->cluster_free;
@@ -522,13 +609,13 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
 #if FAT_FAT32_SUPPORT
         if(is_fat32)
         {
-            if(!device_read(fat_offset + (offset_t) cluster_current * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
+            if(!fat_read_entry(fs, fat_offset + (offset_t) cluster_current * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
                 return 0;
         }
         else
 #endif
         {
-            if(!device_read(fat_offset + (offset_t) cluster_current * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
+            if(!fat_read_entry(fs, fat_offset + (offset_t) cluster_current * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
                 return 0;
         }
 
@@ -555,7 +642,7 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
             else
                 fat_entry32 = htol32(cluster_next);
 
-            if(!device_write(fat_offset + (offset_t) cluster_current * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
+            if(!fat_write_entry(fs, fat_offset + (offset_t) cluster_current * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
                 break;
         }
         else
@@ -581,7 +668,7 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
             else
                 fat_entry16 = htol16((uint16_t) cluster_next);
 
-            if(!device_write(fat_offset + (offset_t) cluster_current * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
+            if(!fat_write_entry(fs, fat_offset + (offset_t) cluster_current * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
                 break;
         }
 
@@ -604,7 +691,7 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
             {
                 fat_entry32 = htol32(cluster_next);
 
-                if(!device_write(fat_offset + (offset_t) cluster_num * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
+                if(!fat_write_entry(fs, fat_offset + (offset_t) cluster_num * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
                     break;
             }
             else
@@ -612,7 +699,7 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
             {
                 fat_entry16 = htol16((uint16_t) cluster_next);
 
-                if(!device_write(fat_offset + (offset_t) cluster_num * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
+                if(!fat_write_entry(fs, fat_offset + (offset_t) cluster_num * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
                     break;
             }
         }
@@ -660,7 +747,7 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
         uint32_t fat_entry;
         while(cluster_num)
         {
-            if(!fs->partition->device_read(fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+            if(!fat_read_entry(fs, fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
                 return 0;
 
             /* get next cluster of current cluster before freeing current cluster */
@@ -685,7 +772,7 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
 
             /* free cluster */
             fat_entry = HTOL32(FAT32_CLUSTER_FREE);
-            fs->partition->device_write(fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry));
+            fat_write_entry(fs, fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry));
 
             /* We continue in any case here, even if freeing the cluster failed.
              * The cluster is lost, but maybe we can still free up some later ones.
@@ -700,7 +787,7 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
         uint16_t fat_entry;
         while(cluster_num)
         {
-            if(!fs->partition->device_read(fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+            if(!fat_read_entry(fs, fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
                 return 0;
 
             /* get next cluster of current cluster before freeing current cluster */
@@ -719,7 +806,7 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
 
             /* free cluster */
             fat_entry = HTOL16(FAT16_CLUSTER_FREE);
-            fs->partition->device_write(fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry));
+            fat_write_entry(fs, fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry));
 
             /* We continue in any case here, even if freeing the cluster failed.
              * The cluster is lost, but maybe we can still free up some later ones.
@@ -759,14 +846,14 @@ uint8_t fat_terminate_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
     if(fs->partition->type == PARTITION_TYPE_FAT32)
     {
         uint32_t fat_entry = HTOL32(FAT32_CLUSTER_LAST_MAX);
-        if(!fs->partition->device_write(fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+        if(!fat_write_entry(fs, fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
             return 0;
     }
     else
 #endif
     {
         uint16_t fat_entry = HTOL16(FAT16_CLUSTER_LAST_MAX);
-        if(!fs->partition->device_write(fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+        if(!fat_write_entry(fs, fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
             return 0;
     }
 
@@ -949,6 +1036,9 @@ struct fat_file_struct* fat_open_file(struct fat_fs_struct* fs, const struct fat
     fd->fs = fs;
     fd->pos = 0;
     fd->pos_cluster = dir_entry->cluster;
+#if FAT_RUN_MAX
+    fd->run_start = fd->run_end = 0;
+#endif
 
     return fd;
 }
@@ -1025,7 +1115,7 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
             while(pos >= cluster_size)
             {
                 pos -= cluster_size;
-                cluster_num = fat_get_next_cluster(fd->fs, cluster_num);
+                cluster_num = fat_file_next_cluster(fd, cluster_num);
                 if(!cluster_num)
                     return -1;
             }
@@ -1041,7 +1131,10 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
         if(copy_length > buffer_left)
             copy_length = buffer_left;
 
-        /* read data */
+        /* Read data. The whole cluster part goes to the device in one
+         * call, so the whole blocks of it can be read straight into
+         * the buffer.
+         */
         if(!fd->fs->partition->device_read(cluster_offset, buffer, copy_length))
             return buffer_len - buffer_left;
 
@@ -1053,7 +1146,7 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
         if(first_cluster_offset + copy_length >= cluster_size)
         {
             /* we are on a cluster boundary, so get the next cluster */
-            if((cluster_num = fat_get_next_cluster(fd->fs, cluster_num)))
+            if((cluster_num = fat_file_next_cluster(fd, cluster_num)))
             {
                 first_cluster_offset = 0;
             }
@@ -1132,6 +1225,9 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
 
                     /* the file exactly ends on a cluster boundary, and we append to it */
                     cluster_num_next = fat_append_clusters(fd->fs, cluster_num, 1);
+#if FAT_RUN_MAX
+                    fd->run_start = fd->run_end = 0;
+#endif
                     if(!cluster_num_next)
                         return 0;
                 }
@@ -1162,10 +1258,15 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
         if(first_cluster_offset + write_length >= cluster_size)
         {
             /* we are on a cluster boundary, so get the next cluster */
-            cluster_t cluster_num_next = fat_get_next_cluster(fd->fs, cluster_num);
+            cluster_t cluster_num_next = fat_file_next_cluster(fd, cluster_num);
             if(!cluster_num_next && buffer_left > 0)
+            {
                 /* we reached the last cluster, append a new one */
                 cluster_num_next = fat_append_clusters(fd->fs, cluster_num, 1);
+#if FAT_RUN_MAX
+                fd->run_start = fd->run_end = 0;
+#endif
+            }
             if(!cluster_num_next)
             {
                 fd->pos_cluster = 0;
@@ -1279,6 +1380,115 @@ uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whenc
     return 1;
 }
 
+/**
+ * \ingroup fat_file
+ * Retrieves the current file position together with the cluster it lies in.
+ *
+ * If the cluster is not known yet, it is looked up by following the cluster
+ * chain from the start of the file. Handing both values to
+ * fat_seek_file_cluster() later on restores the file position without
+ * following the chain again.
+ *
+ * \param[in] fd The file decriptor of the file.
+ * \param[out] offset The absolute file position.
+ * \param[out] cluster The cluster the file position lies in.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_seek_file_cluster
+ */
+uint8_t fat_tell_file(struct fat_file_struct* fd, uint32_t* offset, cluster_t* cluster)
+{
+    if(!fd || !offset || !cluster)
+        return 0;
+
+    if(!fd->pos_cluster)
+    {
+        uint16_t cluster_size = fd->fs->header.cluster_size;
+        cluster_t cluster_num = fd->dir_entry.cluster;
+        uint32_t pos = fd->pos;
+
+        if(!cluster_num)
+            return 0;
+
+        while(pos >= cluster_size)
+        {
+            pos -= cluster_size;
+            cluster_num = fat_file_next_cluster(fd, cluster_num);
+            if(!cluster_num)
+                return 0;
+        }
+
+        fd->pos_cluster = cluster_num;
+    }
+
+    *offset = fd->pos;
+    *cluster = fd->pos_cluster;
+    return 1;
+}
+
+/**
+ * \ingroup fat_file
+ * Sets the file position to a location retrieved by fat_tell_file().
+ *
+ * Unlike fat_seek_file(), the cluster chain is not followed again on the
+ * next read or write, so this takes the same time wherever the position is.
+ * The file must not have been resized since the location was retrieved.
+ *
+ * \param[in] fd The file decriptor of the file on which to seek.
+ * \param[in] offset The absolute file position, as returned by fat_tell_file().
+ * \param[in] cluster The cluster of this position, as returned by fat_tell_file().
+ * \returns 0 on failure, 1 on success.
+ * \see fat_tell_file, fat_seek_file
+ */
+uint8_t fat_seek_file_cluster(struct fat_file_struct* fd, uint32_t offset, cluster_t cluster)
+{
+    if(!fd || offset > fd->dir_entry.file_size)
+        return 0;
+
+    fd->pos = offset;
+    fd->pos_cluster = cluster;
+    return 1;
+}
+
+/**
+ * \ingroup fat_file
+ * Retrieves where the file position lies on the device, and how many bytes
+ * of the file follow it there without a gap.
+ *
+ * The bytes up to the end of the run of consecutive clusters the position
+ * lies in can be written to the device directly, one block after the
+ * other, as long as the file is not resized meanwhile.
+ *
+ * \param[in] fd The file decriptor of the file.
+ * \param[out] offset The device offset of the file position.
+ * \param[out] length The number of bytes following it on the device, at most up to the end of the file.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_tell_file
+ */
+uint8_t fat_get_file_extent(struct fat_file_struct* fd, offset_t* offset, uint32_t* length)
+{
+    uint32_t pos;
+    cluster_t cluster_num;
+
+    if(!offset || !length || !fat_tell_file(fd, &pos, &cluster_num))
+        return 0;
+
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    uint16_t cluster_offset = (uint16_t) (pos & (cluster_size - 1));
+
+    *offset = fat_cluster_offset(fd->fs, cluster_num) + cluster_offset;
+#if FAT_RUN_MAX
+    /* fill in the run the position lies in */
+    fat_file_next_cluster(fd, cluster_num);
+    *length = (uint32_t) (fd->run_end - cluster_num + 1) * cluster_size - cluster_offset;
+#else
+    *length = cluster_size - cluster_offset;
+#endif
+    if(*length > fd->dir_entry.file_size - pos)
+        *length = fd->dir_entry.file_size - pos;
+
+    return 1;
+}
+
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_file
@@ -1308,6 +1518,11 @@ uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size)
     uint16_t cluster_size = fd->fs->header.cluster_size;
     uint32_t size_new = size;
 
+#if FAT_RUN_MAX
+    /* the cluster chain changes */
+    fd->run_start = fd->run_end = 0;
+#endif
+
     do
     {
         if(cluster_num == 0 && size_new == 0)
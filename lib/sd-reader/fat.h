@@ -97,6 +97,9 @@ void fat_close_file(struct fat_file_struct* fd);
 intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t buffer_len);
 intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintptr_t buffer_len);
 uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whence);
+uint8_t fat_tell_file(struct fat_file_struct* fd, uint32_t* offset, cluster_t* cluster);
+uint8_t fat_seek_file_cluster(struct fat_file_struct* fd, uint32_t offset, cluster_t cluster);
+uint8_t fat_get_file_extent(struct fat_file_struct* fd, offset_t* offset, uint32_t* length);
 uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size);
 
 struct fat_dir_struct* fat_open_dir(struct fat_fs_struct* fs, const struct fat_dir_entry_struct* dir_entry);
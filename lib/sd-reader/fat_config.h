@@ -92,6 +92,33 @@ extern "C"
 /* forward declaration for the above */
 void get_datetime(uint16_t* year, uint8_t* month, uint8_t* day, uint8_t* hour, uint8_t* min, uint8_t* sec);
 
+/**
+ * \ingroup fat_config
+ * Determines the function used for telling the device what accesses are for.
+ *
+ * Define this to the function call which marks the following accesses
+ * as metadata (\c meta is 1) or file data (\c meta is 0), and returns
+ * the previous setting. Accesses to the file allocation table are marked
+ * as metadata, so a device with a cache for it keeps them apart from the
+ * file data. Define it to 0 if the device takes no such hint.
+ *
+ * \param[in] meta 1 for metadata, 0 for file data.
+ */
+#define fat_device_hint(meta) sd_raw_hint(meta)
+/* forward declaration for the above */
+uint8_t sd_raw_hint(uint8_t hint);
+
+/**
+ * \ingroup fat_config
+ * Maximum number of clusters looked ahead when reading a file.
+ *
+ * Reading a file finds the run of consecutive clusters it is in once,
+ * and follows it without going back to the FAT for every cluster, so
+ * sequential reads are not interrupted. Set to 0 to follow the FAT for
+ * every cluster.
+ */
+#define FAT_RUN_MAX 64
+
 /**
  * \ingroup fat_config
  * Maximum number of filesystem handles.
@@ -102,7 +129,7 @@ void get_datetime(uint16_t* year, uint8_t* month, uint8_t* day, uint8_t* hour, u
  * \ingroup fat_config
  * Maximum number of file handles.
  */
-#define FAT_FILE_COUNT 2
+#define FAT_FILE_COUNT 4
 
 /**
  * \ingroup fat_config
@@ -62,6 +62,8 @@
 #define CMD_READ_SINGLE_BLOCK 0x11
 /* CMD18: arg0[31:0]: data address, response R1 */
 #define CMD_READ_MULTIPLE_BLOCK 0x12
+/* ACMD23: arg0[22:0]: number of blocks, response R1 */
+#define CMD_SET_WR_BLK_ERASE_COUNT 0x17
 /* CMD24: arg0[31:0]: data address, response R1 */
 #define CMD_WRITE_SINGLE_BLOCK 0x18
 /* CMD25: arg0[31:0]: data address, response R1 */
@@ -157,13 +159,61 @@ static uint8_t raw_block_written;
 #endif
 #endif
 
+#if SD_RAW_META_BLOCKS
+/* pool of blocks cached for metadata */
+static uint8_t meta_block[SD_RAW_META_BLOCKS][512];
+/* offsets where the blocks of the pool lie on the card, -1 if unused */
+static offset_t meta_address[SD_RAW_META_BLOCKS];
+#if SD_RAW_WRITE_SUPPORT
+/* flags to remember which blocks of the pool were changed */
+static uint8_t meta_dirty[SD_RAW_META_BLOCKS];
+#endif
+/* indices into the pool, most recently used first */
+static uint8_t meta_order[SD_RAW_META_BLOCKS];
+#endif
+
+/* what the following accesses are for */
+static uint8_t cache_hint;
+/* hit and miss counters of the caches */
+static struct sd_raw_cache_stats cache_stats;
+
 /* card type state */
 static uint8_t sd_raw_card_type;
 
+#if SD_RAW_BENCH
+/* flag to move blocks byte by byte instead of with the block loops */
+static uint8_t spi_bytewise;
+#endif
+
+#if SD_RAW_STREAM
+/* flag set while a multiple block read is open */
+static uint8_t stream_active;
+/* offset of the block the open read delivers next */
+static offset_t stream_address;
+/* offset of the block read from the card last */
+static offset_t read_address;
+#if SD_RAW_WRITE_SUPPORT
+/* flag set while a multiple block write is open */
+static uint8_t write_active;
+/* offset of the block the open write takes next */
+static offset_t write_address;
+#endif
+#endif
+
 /* private helper functions */
 static void sd_raw_send_byte(uint8_t b);
 static uint8_t sd_raw_rec_byte(void);
 static uint8_t sd_raw_send_command(uint8_t command, uint32_t arg);
+#if !SD_RAW_SAVE_RAM
+static uint8_t sd_raw_read_block(offset_t block_address, uint8_t* block);
+#endif
+#if SD_RAW_WRITE_SUPPORT
+static uint8_t sd_raw_write_block(offset_t block_address, const uint8_t* block);
+static uint8_t sd_raw_flush(void);
+#endif
+#if SD_RAW_META_BLOCKS
+static uint8_t sd_raw_meta_get(offset_t block_address, uint8_t* index);
+#endif
 
 /**
  * \ingroup sd_raw
@@ -198,6 +248,12 @@ uint8_t sd_raw_init(void)
 
     /* initialization procedure */
     sd_raw_card_type = 0;
+#if SD_RAW_STREAM
+    stream_active = 0;
+#if SD_RAW_WRITE_SUPPORT
+    write_active = 0;
+#endif
+#endif
     
     if(!sd_raw_available()) {
         ks0108_gotoxy(0,0);
@@ -328,6 +384,22 @@ uint8_t sd_raw_init(void)
     SPCR &= ~((1 << SPR1) | (1 << SPR0)); /* Clock Frequency: f_OSC / 4 */
     SPSR |= (1 << SPI2X); /* Doubled Clock Frequency: f_OSC / 2 */
 
+#if SD_RAW_META_BLOCKS
+    /* empty the metadata pool */
+    for(uint8_t i = 0; i < SD_RAW_META_BLOCKS; ++i)
+    {
+        meta_address[i] = (offset_t) -1;
+#if SD_RAW_WRITE_SUPPORT
+        meta_dirty[i] = 0;
+#endif
+        meta_order[i] = i;
+    }
+#endif
+    cache_hint = SD_RAW_HINT_DATA;
+#if SD_RAW_STREAM
+    read_address = (offset_t) -1;
+#endif
+
 #if !SD_RAW_SAVE_RAM
     /* the first block is likely to be accessed first, so precache it here */
     raw_block_address = (offset_t) -1;
@@ -395,6 +467,93 @@ uint8_t sd_raw_rec_byte(void)
     return SPDR;
 }
 
+/* Block transfer steps. The byte to send is fetched before waiting for
+ * the one shifting out, and a byte received is stored after the next one
+ * was started, so the loops wait for nothing but the shift itself and do
+ * not pay a call per byte. Accessing SPDR after SPSR showed SPIF set
+ * clears SPIF.
+ */
+#define sd_raw_spi_wait() while(!(SPSR & (1 << SPIF)))
+#define sd_raw_send_step() do { b = *block++; sd_raw_spi_wait(); SPDR = b; } while(0)
+#define sd_raw_rec_step() do { sd_raw_spi_wait(); b = SPDR; SPDR = 0xff; *block++ = b; } while(0)
+
+/**
+ * \ingroup sd_raw
+ * Sends a data block with its start byte and a dummy crc16.
+ *
+ * \param[in] token The start byte.
+ * \param[in] block The 512 bytes of the block.
+ */
+static inline __attribute__((always_inline)) void sd_raw_send_block(uint8_t token, const uint8_t* block)
+{
+    uint8_t b;
+
+#if SD_RAW_BENCH
+    if(spi_bytewise)
+    {
+        sd_raw_send_byte(token);
+        for(uint16_t i = 0; i < 512; ++i)
+            sd_raw_send_byte(*block++);
+        sd_raw_send_byte(0xff);
+        sd_raw_send_byte(0xff);
+        return;
+    }
+#endif
+
+    SPDR = token;
+    for(uint8_t i = 0; i < 512 / 4; ++i)
+    {
+        sd_raw_send_step();
+        sd_raw_send_step();
+        sd_raw_send_step();
+        sd_raw_send_step();
+    }
+
+    /* write dummy crc16 */
+    sd_raw_spi_wait();
+    SPDR = 0xff;
+    sd_raw_spi_wait();
+    SPDR = 0xff;
+    sd_raw_spi_wait();
+}
+
+/**
+ * \ingroup sd_raw
+ * Receives a data block and its crc16, after its start byte.
+ *
+ * \param[out] block The buffer into which to write the 512 bytes of the block.
+ */
+static inline __attribute__((always_inline)) void sd_raw_rec_block(uint8_t* block)
+{
+    uint8_t b;
+
+#if SD_RAW_BENCH
+    if(spi_bytewise)
+    {
+        for(uint16_t i = 0; i < 512; ++i)
+            *block++ = sd_raw_rec_byte();
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+        return;
+    }
+#endif
+
+    SPDR = 0xff;
+    for(uint8_t i = 0; i < 512 / 4; ++i)
+    {
+        sd_raw_rec_step();
+        sd_raw_rec_step();
+        sd_raw_rec_step();
+        sd_raw_rec_step();
+    }
+
+    /* read crc16, the first byte is shifting in already */
+    sd_raw_spi_wait();
+    SPDR = 0xff;
+    sd_raw_spi_wait();
+    b = SPDR;
+}
+
 /**
  * \ingroup sd_raw
  * Send a command to the memory card which responses with a R1 response (and possibly others).
@@ -428,6 +587,10 @@ uint8_t sd_raw_send_command(uint8_t command, uint32_t arg)
            sd_raw_send_byte(0xff);
            break;
     }
+
+    /* skip the stuff byte following a stop command */
+    if(command == CMD_STOP_TRANSMISSION)
+        sd_raw_rec_byte();
     
     /* receive response */
     for(uint8_t i = 0; i < 10; ++i)
@@ -444,6 +607,9 @@ uint8_t sd_raw_send_command(uint8_t command, uint32_t arg)
  * \ingroup sd_raw
  * Reads raw data from the card.
  *
+ * Whole blocks of the range which are not cached are received
+ * straight into the buffer, without going through the data block.
+ *
  * \param[in] offset The offset from which to read.
  * \param[out] buffer The buffer into which to write the data.
  * \param[in] length The number of bytes to read.
@@ -455,6 +621,9 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
     offset_t block_address;
     uint16_t block_offset;
     uint16_t read_length;
+#if SD_RAW_META_BLOCKS
+    uint8_t index;
+#endif
     while(length > 0)
     {
         /* determine byte count to read at once */
@@ -463,17 +632,29 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
         read_length = 512 - block_offset; /* read up to block border */
         if(read_length > length)
             read_length = length;
+
+#if SD_RAW_META_BLOCKS
+        /* metadata goes through its own pool, and so does
+         * anything else in a block which is in it already
+         */
+        if(!sd_raw_meta_get(block_address, &index))
+            return 0;
+        if(index < SD_RAW_META_BLOCKS)
+        {
+            memcpy(buffer, meta_block[index] + block_offset, read_length);
+            buffer += read_length;
+            length -= read_length;
+            offset += read_length;
+            continue;
+        }
+#endif
         
 #if !SD_RAW_SAVE_RAM
         /* check if the requested data is cached */
         if(block_address != raw_block_address)
 #endif
         {
-#if SD_RAW_WRITE_BUFFERING
-            if(!sd_raw_sync())
-                return 0;
-#endif
-
+#if SD_RAW_SAVE_RAM
             /* address card */
             select_card();
 
@@ -491,7 +672,6 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
             /* wait for data block (start byte 0xfe) */
             while(sd_raw_rec_byte() != 0xfe);
 
-#if SD_RAW_SAVE_RAM
             /* read byte block */
             uint16_t read_to = block_offset + read_length;
             for(uint16_t i = 0; i < 512; ++i)
@@ -500,16 +680,6 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
                 if(i >= block_offset && i < read_to)
                     *buffer++ = b;
             }
-#else
-            /* read byte block */
-            uint8_t* cache = raw_block;
-            for(uint16_t i = 0; i < 512; ++i)
-                *cache++ = sd_raw_rec_byte();
-            raw_block_address = block_address;
-
-            memcpy(buffer, raw_block + block_offset, read_length);
-            buffer += read_length;
-#endif
             
             /* read crc16 */
             sd_raw_rec_byte();
@@ -520,11 +690,65 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
 
             /* let card some time to finish */
             sd_raw_rec_byte();
+#else
+            ++cache_stats.data_misses;
+
+            /* A whole block is received straight into the buffer,
+             * leaving the data block as it is.
+             */
+            uint8_t* block = raw_block;
+            if(block_offset == 0 && read_length == 512)
+                block = buffer;
+
+#if SD_RAW_WRITE_BUFFERING
+            /* the data block is about to be overwritten */
+            if(block == raw_block && !sd_raw_flush())
+                return 0;
+#endif
+
+#if SD_RAW_STREAM
+#if SD_RAW_WRITE_SUPPORT
+            sd_raw_write_close();
+#endif
+
+            /* Carry on with the open multiple block read if it is at
+             * this block, or start one if the reads look sequential,
+             * that is the block follows the last one read or the
+             * request goes on into the next block.
+             */
+            if(stream_active && stream_address != block_address)
+                sd_raw_stream_stop();
+            if(!stream_active && (block_address == read_address + 512 || length > read_length))
+            {
+                if(!sd_raw_stream_open(block_address))
+                    return 0;
+            }
+            if(stream_active)
+            {
+                if(!sd_raw_stream_next(block))
+                    return 0;
+            }
+            else
+#endif
+            if(!sd_raw_read_block(block_address, block))
+                return 0;
+#if SD_RAW_STREAM
+            read_address = block_address;
+#endif
+
+            if(block == raw_block)
+            {
+                raw_block_address = block_address;
+                memcpy(buffer, raw_block + block_offset, read_length);
+            }
+            buffer += read_length;
+#endif
         }
 #if !SD_RAW_SAVE_RAM
         else
         {
             /* use cached data */
+            ++cache_stats.data_hits;
             memcpy(buffer, raw_block + block_offset, read_length);
             buffer += read_length;
         }
@@ -537,6 +761,156 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
     return 1;
 }
 
+#if !SD_RAW_SAVE_RAM
+/**
+ * \ingroup sd_raw
+ * Reads a whole block from the card with a single block read.
+ *
+ * \param[in] block_address The offset of the block.
+ * \param[out] block The buffer into which to write the 512 bytes of the block.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_read_block(offset_t block_address, uint8_t* block)
+{
+#if SD_RAW_STREAM
+    sd_raw_stream_stop();
+#if SD_RAW_WRITE_SUPPORT
+    sd_raw_write_close();
+#endif
+#endif
+
+    /* address card */
+    select_card();
+
+    /* send single block request */
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+#else
+    if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, block_address))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* wait for data block (start byte 0xfe) */
+    while(sd_raw_rec_byte() != 0xfe);
+
+    /* read byte block and crc16 */
+    sd_raw_rec_block(block);
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+
+    return 1;
+}
+#endif
+
+#if DOXYGEN || SD_RAW_STREAM
+/**
+ * \ingroup sd_raw
+ * Starts a multiple block read.
+ *
+ * The card keeps sending blocks from the one containing \c offset
+ * on, one after the other, until sd_raw_stream_stop() is called.
+ * Each block is fetched with sd_raw_stream_next(), without the command
+ * and response a single block read needs.
+ *
+ * \note The card stays addressed while the read is open. Any other
+ *       command stops it first.
+ *
+ * \param[in] offset The offset from which to read, rounded down to a block.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_stream_next, sd_raw_stream_stop
+ */
+uint8_t sd_raw_stream_open(offset_t offset)
+{
+    offset_t block_address = offset - (offset & 0x01ff);
+
+    sd_raw_stream_stop();
+#if SD_RAW_WRITE_SUPPORT
+    if(!sd_raw_flush())
+        return 0;
+    sd_raw_write_close();
+#endif
+
+    /* address card */
+    select_card();
+
+    /* send multiple block request */
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_READ_MULTIPLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+#else
+    if(sd_raw_send_command(CMD_READ_MULTIPLE_BLOCK, block_address))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    stream_active = 1;
+    stream_address = block_address;
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Reads the next block of a multiple block read.
+ *
+ * \param[out] buffer The buffer into which to write the 512 bytes of the block.
+ * \returns 0 on failure (the read is stopped then), 1 on success.
+ * \see sd_raw_stream_open, sd_raw_stream_stop
+ */
+uint8_t sd_raw_stream_next(uint8_t* buffer)
+{
+    uint8_t token;
+
+    if(!stream_active)
+        return 0;
+
+    /* wait for data block (start byte 0xfe), anything else is an error token */
+    while((token = sd_raw_rec_byte()) == 0xff);
+    if(token != 0xfe)
+    {
+        sd_raw_stream_stop();
+        return 0;
+    }
+
+    /* read byte block and crc16 */
+    sd_raw_rec_block(buffer);
+
+    stream_address += 512;
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Stops a multiple block read, if one is open.
+ *
+ * \see sd_raw_stream_open, sd_raw_stream_next
+ */
+void sd_raw_stream_stop(void)
+{
+    if(!stream_active)
+        return;
+    stream_active = 0;
+
+    sd_raw_send_command(CMD_STOP_TRANSMISSION, 0);
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+}
+#endif
+
 /**
  * \ingroup sd_raw
  * Continuously reads units of \c interval bytes and calls a callback function.
@@ -682,6 +1056,9 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
     offset_t block_address;
     uint16_t block_offset;
     uint16_t write_length;
+#if SD_RAW_META_BLOCKS
+    uint8_t index;
+#endif
     while(length > 0)
     {
         /* determine byte count to write at once */
@@ -690,24 +1067,55 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
         write_length = 512 - block_offset; /* write up to block border */
         if(write_length > length)
             write_length = length;
+
+#if SD_RAW_META_BLOCKS
+        /* blocks in the metadata pool are written back
+         * when they leave it or on sd_raw_sync()
+         */
+        if(!sd_raw_meta_get(block_address, &index))
+            return 0;
+        if(index < SD_RAW_META_BLOCKS)
+        {
+            memcpy(meta_block[index] + block_offset, buffer, write_length);
+            meta_dirty[index] = 1;
+            buffer += write_length;
+            offset += write_length;
+            length -= write_length;
+            continue;
+        }
+#endif
         
         /* Merge the data to write with the content of the block.
          * Use the cached block if available.
          */
         if(block_address != raw_block_address)
         {
+            ++cache_stats.data_misses;
 #if SD_RAW_WRITE_BUFFERING
-            if(!sd_raw_sync())
+            if(!sd_raw_flush())
                 return 0;
 #endif
 
             if(block_offset || write_length < 512)
             {
+#if SD_RAW_STREAM
+                /* the blocks of an open multiple block write are
+                 * written from their start on up to their end, so
+                 * there is nothing to merge with
+                 */
+                if(write_active && block_address == write_address && !block_offset)
+                    memset(raw_block, 0, sizeof(raw_block));
+                else
+#endif
                 if(!sd_raw_read(block_address, raw_block, sizeof(raw_block)))
                     return 0;
             }
             raw_block_address = block_address;
         }
+        else if(buffer != raw_block)
+        {
+            ++cache_stats.data_hits;
+        }
 
         if(buffer != raw_block)
         {
@@ -721,38 +1129,27 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
 #endif
         }
 
-        /* address card */
-        select_card();
+#if SD_RAW_STREAM
+        /* the block following the open multiple block write goes on
+         * the end of it, any other block ends it
+         */
+        if(write_active && block_address == write_address)
+        {
+            if(!sd_raw_write_push(raw_block))
+                return 0;
 
-        /* send single block request */
-#if SD_RAW_SDHC
-        if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
-#else
-        if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, block_address))
+            buffer += write_length;
+            offset += write_length;
+            length -= write_length;
+#if SD_RAW_WRITE_BUFFERING
+            raw_block_written = 1;
 #endif
-        {
-            unselect_card();
-            return 0;
+            continue;
         }
+#endif
 
-        /* send start byte */
-        sd_raw_send_byte(0xfe);
-
-        /* write byte block */
-        uint8_t* cache = raw_block;
-        for(uint16_t i = 0; i < 512; ++i)
-            sd_raw_send_byte(*cache++);
-
-        /* write dummy crc16 */
-        sd_raw_send_byte(0xff);
-        sd_raw_send_byte(0xff);
-
-        /* wait while card is busy */
-        while(sd_raw_rec_byte() != 0xff);
-        sd_raw_rec_byte();
-
-        /* deaddress card */
-        unselect_card();
+        if(!sd_raw_write_block(block_address, raw_block))
+            return 0;
 
         buffer += write_length;
         offset += write_length;
@@ -765,6 +1162,48 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
 
     return 1;
 }
+
+/**
+ * \ingroup sd_raw
+ * Writes a whole block to the card with a single block write.
+ *
+ * \param[in] block_address The offset of the block.
+ * \param[in] block The 512 bytes of the block.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_write_block(offset_t block_address, const uint8_t* block)
+{
+#if SD_RAW_STREAM
+    sd_raw_stream_stop();
+    sd_raw_write_close();
+#endif
+
+    /* address card */
+    select_card();
+
+    /* send single block request */
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+#else
+    if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, block_address))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* send start byte, byte block and dummy crc16 */
+    sd_raw_send_block(0xfe, block);
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+    sd_raw_rec_byte();
+
+    /* deaddress card */
+    unselect_card();
+
+    return 1;
+}
 #endif
 
 #if DOXYGEN || SD_RAW_WRITE_SUPPORT
@@ -821,7 +1260,9 @@ uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length
 #if DOXYGEN || SD_RAW_WRITE_SUPPORT
 /**
  * \ingroup sd_raw
- * Writes the write buffer's content to the card.
+ * Writes the write buffer's content and the changed
+ * blocks of the metadata pool to the card, and ends an
+ * open multiple block write.
  *
  * \note When write buffering is enabled, you should
  *       call this function before disconnecting the
@@ -832,6 +1273,34 @@ uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length
  * \see sd_raw_write
  */
 uint8_t sd_raw_sync(void)
+{
+    if(!sd_raw_flush())
+        return 0;
+#if SD_RAW_META_BLOCKS
+    for(uint8_t i = 0; i < SD_RAW_META_BLOCKS; ++i)
+    {
+        if(!meta_dirty[i])
+            continue;
+        if(!sd_raw_write_block(meta_address[i], meta_block[i]))
+            return 0;
+        meta_dirty[i] = 0;
+    }
+#endif
+#if SD_RAW_STREAM
+    sd_raw_write_close();
+#endif
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Writes the write buffer's content to the card, into an open
+ * multiple block write if it is the next block of it.
+ *
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_sync
+ */
+uint8_t sd_raw_flush(void)
 {
 #if SD_RAW_WRITE_BUFFERING
     if(raw_block_written)
@@ -844,6 +1313,281 @@ uint8_t sd_raw_sync(void)
 }
 #endif
 
+#if DOXYGEN || (SD_RAW_STREAM && SD_RAW_WRITE_SUPPORT)
+/**
+ * \ingroup sd_raw
+ * Starts a multiple block write.
+ *
+ * Blocks written with sd_raw_write() from the block containing
+ * \c offset on, one after the other, go out with one write command.
+ * Each block is sent as soon as it is complete, without waiting for
+ * the card to program the one before, and the card is only waited
+ * for when the next block is sent. The write ends with
+ * sd_raw_write_close(), sd_raw_sync() or any other access to the card.
+ *
+ * The card is told to erase \c count blocks beforehand, which makes
+ * writing them faster. The range is expected to be overwritten as a
+ * whole, so a block of it written from its start is not read from the
+ * card first to merge with.
+ *
+ * \param[in] offset The offset where to start writing, rounded down to a block.
+ * \param[in] count The number of blocks that will be written, or 0 if not known.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_write_push, sd_raw_write_busy, sd_raw_write_close
+ */
+uint8_t sd_raw_write_open(offset_t offset, uint32_t count)
+{
+    offset_t block_address = offset - (offset & 0x01ff);
+
+    if(sd_raw_locked())
+        return 0;
+
+    sd_raw_stream_stop();
+    sd_raw_write_close();
+
+    /* the buffered block goes out now, unless it is the first one */
+#if SD_RAW_WRITE_BUFFERING
+    if(raw_block_address != block_address && !sd_raw_flush())
+        return 0;
+#endif
+
+    /* address card */
+    select_card();
+
+    /* set the pre-erase count, sd cards only */
+    if(count && (sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2))))
+    {
+        sd_raw_send_command(CMD_APP, 0);
+        sd_raw_send_command(CMD_SET_WR_BLK_ERASE_COUNT, count & 0x7fffff);
+    }
+
+    /* send multiple block request */
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_WRITE_MULTIPLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+#else
+    if(sd_raw_send_command(CMD_WRITE_MULTIPLE_BLOCK, block_address))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    write_active = 1;
+    write_address = block_address;
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Sends the next block of a multiple block write.
+ *
+ * Waits for the card to finish the block before, if it is still
+ * busy with it, but not for this one.
+ *
+ * \param[in] buffer The 512 bytes of the block.
+ * \returns 0 on failure (the write is ended then), 1 on success.
+ * \see sd_raw_write_open, sd_raw_write_busy
+ */
+uint8_t sd_raw_write_push(const uint8_t* buffer)
+{
+    if(!write_active)
+        return 0;
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* send start byte, byte block and dummy crc16 */
+    sd_raw_send_block(0xfc, buffer);
+
+    /* data response */
+    if((sd_raw_rec_byte() & 0x1f) != 0x05)
+    {
+        sd_raw_write_close();
+        return 0;
+    }
+
+    write_address += 512;
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Checks whether the card is still programming the last block
+ * of a multiple block write.
+ *
+ * \returns 1 if the card is busy, 0 if the next block can go out at once.
+ * \see sd_raw_write_push
+ */
+uint8_t sd_raw_write_busy(void)
+{
+    if(!write_active)
+        return 0;
+    return sd_raw_rec_byte() != 0xff;
+}
+
+/**
+ * \ingroup sd_raw
+ * Checks whether a multiple block write is open.
+ *
+ * \returns 1 if it is, 0 if it is not.
+ */
+uint8_t sd_raw_write_active(void)
+{
+    return write_active;
+}
+
+/**
+ * \ingroup sd_raw
+ * Ends a multiple block write, if one is open, and waits for the
+ * card to finish it.
+ *
+ * \see sd_raw_write_open
+ */
+void sd_raw_write_close(void)
+{
+    if(!write_active)
+        return;
+    write_active = 0;
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* send stop byte */
+    sd_raw_send_byte(0xfd);
+    sd_raw_rec_byte();
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+}
+#endif
+
+/**
+ * \ingroup sd_raw
+ * Tells what the following reads and writes are for.
+ *
+ * Accesses marked as \c SD_RAW_HINT_META are cached in the metadata
+ * pool, where they stay while data passes through the data block.
+ *
+ * \param[in] hint \c SD_RAW_HINT_DATA or \c SD_RAW_HINT_META.
+ * \returns The hint set before, to restore it with.
+ * \see SD_RAW_META_BLOCKS
+ */
+uint8_t sd_raw_hint(uint8_t hint)
+{
+    uint8_t hint_old = cache_hint;
+    cache_hint = hint;
+    return hint_old;
+}
+
+#if DOXYGEN || SD_RAW_BENCH
+/**
+ * \ingroup sd_raw
+ * Moves blocks byte by byte instead of with the block loops, to
+ * measure what the loops gain.
+ *
+ * \param[in] on 1 to move blocks byte by byte, 0 to use the block loops.
+ */
+void sd_raw_spi_bytewise(uint8_t on)
+{
+    spi_bytewise = on;
+}
+#endif
+
+/**
+ * \ingroup sd_raw
+ * Retrieves the hit and miss counters of the caches.
+ *
+ * \param[out] stats A pointer to the structure into which to save the counters.
+ */
+void sd_raw_get_cache_stats(struct sd_raw_cache_stats* stats)
+{
+    if(stats)
+        *stats = cache_stats;
+}
+
+#if SD_RAW_META_BLOCKS
+/**
+ * \ingroup sd_raw
+ * Finds the block in the metadata pool, or brings it in for a
+ * metadata access.
+ *
+ * A block coming in replaces the least recently used one of the
+ * pool, which is written back first if it was changed. It is taken
+ * over from the data block if it is there, so no block is ever
+ * cached twice.
+ *
+ * \param[in] block_address The offset of the block.
+ * \param[out] index The index of the block in the pool, or \c SD_RAW_META_BLOCKS
+ *                   if the access does not go through the pool.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_meta_get(offset_t block_address, uint8_t* index)
+{
+    uint8_t i;
+    uint8_t n;
+
+    for(i = 0; i < SD_RAW_META_BLOCKS; ++i)
+    {
+        if(meta_address[i] == block_address)
+            break;
+    }
+
+    if(i < SD_RAW_META_BLOCKS)
+    {
+        ++cache_stats.meta_hits;
+    }
+    else
+    {
+        *index = SD_RAW_META_BLOCKS;
+        if(cache_hint != SD_RAW_HINT_META)
+            return 1;
+        ++cache_stats.meta_misses;
+
+        /* replace the least recently used block */
+        i = meta_order[SD_RAW_META_BLOCKS - 1];
+#if SD_RAW_WRITE_SUPPORT
+        if(meta_dirty[i])
+        {
+            if(!sd_raw_write_block(meta_address[i], meta_block[i]))
+                return 0;
+            meta_dirty[i] = 0;
+        }
+#endif
+        meta_address[i] = (offset_t) -1;
+
+        if(block_address == raw_block_address)
+        {
+            memcpy(meta_block[i], raw_block, 512);
+#if SD_RAW_WRITE_BUFFERING
+            meta_dirty[i] = !raw_block_written;
+            raw_block_written = 1;
+#endif
+            raw_block_address = (offset_t) -1;
+        }
+        else if(!sd_raw_read_block(block_address, meta_block[i]))
+        {
+            return 0;
+        }
+        meta_address[i] = block_address;
+    }
+
+    /* move the block to the front of the order */
+    for(n = 0; meta_order[n] != i; ++n);
+    for(; n > 0; --n)
+        meta_order[n] = meta_order[n - 1];
+    meta_order[0] = i;
+
+    *index = i;
+    return 1;
+}
+#endif
+
 /**
  * \ingroup sd_raw
  * Reads informational data from the card.
@@ -866,6 +1610,12 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
 
     memset(info, 0, sizeof(*info));
 
+#if SD_RAW_STREAM
+    sd_raw_stream_stop();
+#if SD_RAW_WRITE_SUPPORT
+    sd_raw_write_close();
+#endif
+#endif
     select_card();
 
     /* read cid register */
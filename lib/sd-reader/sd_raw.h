@@ -49,6 +49,17 @@ extern "C"
  */
 #define SD_RAW_FORMAT_UNKNOWN 3
 
+/**
+ * The following accesses are for file data, which passes
+ * through the data block.
+ */
+#define SD_RAW_HINT_DATA 0
+/**
+ * The following accesses are for metadata, like the FAT,
+ * which is kept in the metadata pool.
+ */
+#define SD_RAW_HINT_META 1
+
 /**
  * This struct is used by sd_raw_get_info() to return
  * manufacturing and status information of the card.
@@ -121,6 +132,31 @@ struct sd_raw_info
     uint8_t format;
 };
 
+/**
+ * This struct holds the hit and miss counters of the caches.
+ *
+ * \see sd_raw_get_cache_stats
+ */
+struct sd_raw_cache_stats
+{
+    /**
+     * Block accesses served from the data block.
+     */
+    uint32_t data_hits;
+    /**
+     * Block accesses which had to go to the card for the data block.
+     */
+    uint32_t data_misses;
+    /**
+     * Block accesses served from the metadata pool.
+     */
+    uint32_t meta_hits;
+    /**
+     * Metadata block accesses which had to go to the card.
+     */
+    uint32_t meta_misses;
+};
+
 typedef uint8_t (*sd_raw_read_interval_handler_t)(uint8_t* buffer, offset_t offset, void* p);
 typedef uintptr_t (*sd_raw_write_interval_handler_t)(uint8_t* buffer, offset_t offset, void* p);
 
@@ -134,6 +170,25 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length);
 uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length, sd_raw_write_interval_handler_t callback, void* p);
 uint8_t sd_raw_sync(void);
 
+#if SD_RAW_STREAM
+uint8_t sd_raw_stream_open(offset_t offset);
+uint8_t sd_raw_stream_next(uint8_t* buffer);
+void sd_raw_stream_stop(void);
+#if SD_RAW_WRITE_SUPPORT
+uint8_t sd_raw_write_open(offset_t offset, uint32_t count);
+uint8_t sd_raw_write_push(const uint8_t* buffer);
+uint8_t sd_raw_write_busy(void);
+uint8_t sd_raw_write_active(void);
+void sd_raw_write_close(void);
+#endif
+#endif
+
+uint8_t sd_raw_hint(uint8_t hint);
+void sd_raw_get_cache_stats(struct sd_raw_cache_stats* stats);
+#if SD_RAW_BENCH
+void sd_raw_spi_bytewise(uint8_t on);
+#endif
+
 uint8_t sd_raw_get_info(struct sd_raw_info* info);
 
 /**
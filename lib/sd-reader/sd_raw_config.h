@@ -58,6 +58,44 @@ extern "C"
  */
 #define SD_RAW_SAVE_RAM 1
 
+/**
+ * \ingroup sd_raw_config
+ * Controls streaming of sequential reads and writes.
+ *
+ * Set to 1 to read consecutive blocks with one multiple block
+ * read command, kept open between calls to sd_raw_read(), and
+ * to support multiple block write sessions (sd_raw_write_open()).
+ *
+ * \note This option has no effect when SD_RAW_SAVE_RAM is 1.
+ */
+#define SD_RAW_STREAM 1
+
+/**
+ * \ingroup sd_raw_config
+ * Number of blocks cached for metadata.
+ *
+ * Accesses made while sd_raw_hint() is set to SD_RAW_HINT_META,
+ * like the FAT lookups, are cached in a pool of their own with
+ * least recently used replacement and written back when they
+ * leave it or on sd_raw_sync(). Streamed data passes through
+ * the single data block without evicting them. Each block takes
+ * 512 bytes of RAM. Set to 0 to cache everything in the data
+ * block.
+ *
+ * \note This option has no effect when SD_RAW_SAVE_RAM is 1.
+ */
+#define SD_RAW_META_BLOCKS 2
+
+/**
+ * \ingroup sd_raw_config
+ * Controls the switch to move blocks byte by byte.
+ *
+ * Blocks are moved with unrolled loops which keep the SPI busy. Set to 1
+ * to include sd_raw_spi_bytewise(), which switches back to a call per
+ * byte, so a benchmark can compare the two.
+ */
+#define SD_RAW_BENCH 1
+
 /**
  * \ingroup sd_raw_config
  * Controls support for SDHC cards.
@@ -139,6 +177,12 @@ extern "C"
 #undef SD_RAW_WRITE_BUFFERING
 #define SD_RAW_WRITE_BUFFERING 0
 #endif
+#if SD_RAW_SAVE_RAM
+#undef SD_RAW_STREAM
+#define SD_RAW_STREAM 0
+#undef SD_RAW_META_BLOCKS
+#define SD_RAW_META_BLOCKS 0
+#endif
 
 #ifdef __cplusplus
 }
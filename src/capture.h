@@ -0,0 +1,53 @@
+#ifndef __capture_h__
+#define __capture_h__
+
+/*
+Capture options, shared by the c and assembler sources.  Set these in the
+makefile (CDEFS, they are passed on to the assembler as well).
+
+  CAPTURE_ICP   time read data with the timer1 input capture unit
+  CAPTURE_ASM   use the assembler int4 handler in capture.S
+
+With CAPTURE_ASM=1 the int4 handler assembles the bits of a block itself,
+with its state in the general purpose io registers, and only calls into c
+once per byte.  Everything else (gaps, start marks, flux dumps) goes through
+the c decoder as before.
+
+  GPIOR0    flags below
+  GPIOR1    byte being assembled.  starts as a single marker bit (0x01, or
+            0x80 lsb first) that is shifted out into carry with the 8th bit.
+  GPIOR2    threshold - 1, so that cp GPIOR2, time sets carry for a 1 bit
+*/
+
+#ifndef CAPTURE_ICP
+#define CAPTURE_ICP     0
+#endif
+
+#ifndef CAPTURE_ASM
+#define CAPTURE_ASM     0
+#endif
+
+#if CAPTURE_ASM && CAPTURE_ICP
+#error CAPTURE_ASM is only for the int4 handler, build with CAPTURE_ICP=0
+#endif
+
+//GPIOR0 bits
+#define CAPTURE_FAST    0   //inside a block, bits are assembled by capture.S
+#define CAPTURE_LSB     1   //bytes are assembled lsb first (fds blocks)
+
+#ifndef __ASSEMBLER__
+
+#include "types.h"
+
+//sum and number of the short intervals in the byte being assembled, for
+//clock recovery
+extern volatile u16 capture_trksum;
+extern volatile u8 capture_trkcount;
+
+//called from capture.S, with interrupts disabled
+void capture_edge(u8 time);
+void capture_byte(u8 data);
+
+#endif
+
+#endif
@@ -0,0 +1,347 @@
+#include <string.h>
+#include "catalog.h"
+#include "fds.h"
+#include "../lib/sd-reader/sd_raw.h"
+
+//offset of the first entry in the catalog
+#define CATALOG_ENTRIES   (sizeof(catheader_t) + sizeof(catstamp_t) * CATALOG_MAXDIRS)
+
+//the catalog is written to this first and renamed once it is complete, so
+//the entries of the old one can be copied while it is made
+#define CATALOG_TMPNAME   "catalog.tmp"
+
+//the catalog file, and if it was found in the root directory
+static struct fat_fs_struct *catfs;
+static struct fat_dir_entry_struct catfile;
+static u8 catfound;
+
+//images in the catalog
+static u16 count;
+
+//stamps made by the last scan, root first
+static catstamp_t stamps[CATALOG_MAXDIRS];
+static u8 dirs;
+
+//header and stamps of the catalog on the card, and whether they are usable
+static catheader_t oldhdr;
+static catstamp_t oldstamps[CATALOG_MAXDIRS];
+static u8 oldok;
+
+//catalog being written by the scan, 0 if it only makes the stamps, the old
+//one it copies from, and for each directory the old one with the same stamp
+//(0xFF if it changed and has to be scanned again)
+static struct fat_file_struct *out, *old;
+static u8 reuse[CATALOG_MAXDIRS];
+static u8 error;
+
+//add a directory entry to a stamp: its cluster, size, where the entry is and
+//its name, so an image copied in over a deleted one of the same size into
+//the same cluster, or a rename, still changes it
+static u32 addstamp(u32 s, const struct fat_dir_entry_struct *de)
+{
+  const char *c;
+
+  s = ((s << 3) | (s >> 29)) ^ de->cluster ^ de->file_size ^ (u32)de->entry_offset;
+  for(c = de->long_name; *c; c++)
+    s = ((s << 5) | (s >> 27)) + (u8)*c;
+  return(s);
+}
+
+//.fds images are the only ones with a disk info block to index
+static u8 isimage(const char *name)
+{
+  u8 len = strlen(name);
+
+  return(len > 4 && strcasecmp(&name[len - 4], ".fds") == 0);
+}
+
+//index an image and add it to the catalog being written
+static void addimage(const struct fat_dir_entry_struct *de, u8 dir)
+{
+  struct fat_file_struct *fd;
+  fdsindex_t x;
+  catentry_t e;
+
+  memset(&e, 0, sizeof(e));
+  if((fd = fat_open_file(catfs, de)) == 0)
+    return;
+  if((e.sides = fds_index(&x, fd)) != 0) {
+    int32_t at = x.offset[0] + FDS_TITLE_POS;
+
+    if(fat_seek_file(fd, &at, FAT_SEEK_SET))
+      fat_read_file(fd, (u8*)e.title, sizeof(e.title));
+  }
+  fat_close_file(fd);
+  if(e.sides == 0)
+    return;
+
+  strncpy(e.name, de->long_name, sizeof(e.name) - 1);
+  e.attributes = de->attributes;
+  e.dir = dir;
+  e.cluster = de->cluster;
+  e.size = de->file_size;
+  e.diroffset = de->entry_offset;
+  if(fat_write_file(out, (u8*)&e, sizeof(e)) != sizeof(e))
+    error = 1;
+  else
+    count++;
+}
+
+//copy the images of directory k of the old catalog, as directory n
+static void copyimages(u8 k, u8 n)
+{
+  int32_t at = CATALOG_ENTRIES;
+  catentry_t e;
+  u16 i;
+
+  if(fat_seek_file(old, &at, FAT_SEEK_SET) == 0) {
+    error = 1;
+    return;
+  }
+  for(i = 0; i < oldhdr.count; i++) {
+    if(fat_read_file(old, (u8*)&e, sizeof(e)) != sizeof(e)) {
+      error = 1;
+      return;
+    }
+    if(e.dir != k)
+      continue;
+    e.dir = n;
+    if(fat_write_file(out, (u8*)&e, sizeof(e)) != sizeof(e))
+      error = 1;
+    else
+      count++;
+  }
+}
+
+//walk a directory, making its stamp and adding its images if the catalog
+//is being written, copied from the old one if the directory is unchanged.
+//the directories in the root are walked as well.
+static void scandir(struct fat_dir_struct *dd, u32 cluster, u8 root)
+{
+  struct fat_dir_entry_struct de;
+  u32 s = 0;
+  u8 n;
+
+  if(dirs >= CATALOG_MAXDIRS)
+    return;
+  n = dirs++;
+  if(out && reuse[n] != 0xFF)
+    copyimages(reuse[n], n);
+
+  while(fat_read_dir(dd, &de)) {
+
+    //skip . and .., and the catalog itself as it changes with every scan
+    if(de.long_name[0] == '.')
+      continue;
+    if(root && strcmp(de.long_name, CATALOG_NAME) == 0) {
+      if(out == 0)
+        catfile = de;
+      catfound = 1;
+      continue;
+    }
+    if(root && strcmp(de.long_name, CATALOG_TMPNAME) == 0)
+      continue;
+
+    s = addstamp(s, &de);
+    if(de.attributes & FAT_ATTRIB_DIR) {
+      struct fat_dir_struct *sub;
+
+      if(root && (sub = fat_open_dir(catfs, &de)) != 0) {
+        scandir(sub, de.cluster, 0);
+        fat_close_dir(sub);
+      }
+    }
+    else if(out && reuse[n] == 0xFF && isimage(de.long_name))
+      addimage(&de, n);
+  }
+
+  stamps[n].cluster = cluster;
+  stamps[n].stamp = s;
+}
+
+//scan the root directory and the ones in it
+static void scan(struct fat_dir_struct *root)
+{
+  dirs = 0;
+  memset(stamps, 0, sizeof(stamps));
+  fat_reset_dir(root);
+  scandir(root, 0, 1);
+  fat_reset_dir(root);
+}
+
+//read the header and stamps of the catalog on the card, and check it was
+//made from the directories as they are now.  only the stamps are compared,
+//the entries are not read.
+static u8 isvalid(void)
+{
+  struct fat_file_struct *fd;
+
+  oldok = 0;
+  if(catfound == 0 || (fd = fat_open_file(catfs, &catfile)) == 0)
+    return(0);
+  if(fat_read_file(fd, (u8*)&oldhdr, sizeof(oldhdr)) == sizeof(oldhdr) &&
+     fat_read_file(fd, (u8*)oldstamps, sizeof(oldstamps)) == sizeof(oldstamps) &&
+     memcmp(oldhdr.ident, "CAT\x1A", 4) == 0 && oldhdr.version == CATALOG_VERSION &&
+     oldhdr.entrysize == sizeof(catentry_t) && oldhdr.dirs <= CATALOG_MAXDIRS)
+    oldok = 1;
+  fat_close_file(fd);
+
+  if(oldok && oldhdr.dirs == dirs && memcmp(oldstamps, stamps, sizeof(stamps)) == 0) {
+    count = oldhdr.count;
+    return(1);
+  }
+  return(0);
+}
+
+//find a file in the root directory, to get its entry as it is on the card
+static u8 findentry(struct fat_dir_struct *root, const char *name, struct fat_dir_entry_struct *de)
+{
+  u8 found = 0;
+
+  fat_reset_dir(root);
+  while(fat_read_dir(root, de)) {
+    if(strcmp(de->long_name, name) == 0) {
+      found = 1;
+      break;
+    }
+  }
+  fat_reset_dir(root);
+  return(found);
+}
+
+/*
+Write the catalog again.  Only the directories whose stamp changed are
+scanned for images, the entries of the others are copied from the old
+catalog.  The new one is written beside it and renamed over it when it is
+complete.
+*/
+static void rebuild(struct fat_dir_struct *root)
+{
+  struct fat_dir_entry_struct tmpfile;
+  catheader_t h;
+  int32_t at = 0;
+  u8 zero[sizeof(stamps)];
+  u8 i, k;
+
+  count = 0;
+  error = 0;
+
+  //match the directories up with the old ones by cluster and stamp
+  for(i = 0; i < CATALOG_MAXDIRS; i++) {
+    reuse[i] = 0xFF;
+    for(k = 0; oldok && i < dirs && k < oldhdr.dirs; k++) {
+      if(oldstamps[k].cluster == stamps[i].cluster && oldstamps[k].stamp == stamps[i].stamp) {
+        reuse[i] = k;
+        break;
+      }
+    }
+  }
+
+  if(fat_create_file(root, CATALOG_TMPNAME, &tmpfile) == 0)
+    return;
+  fat_reset_dir(root);
+  if((out = fat_open_file(catfs, &tmpfile)) == 0)
+    return;
+  old = 0;
+  if(oldok && (old = fat_open_file(catfs, &catfile)) == 0)
+    memset(reuse, 0xFF, sizeof(reuse));
+
+  //room for the header, filled in once the images are counted
+  memset(zero, 0, sizeof(zero));
+  if(fat_resize_file(out, 0) == 0 ||
+     fat_write_file(out, zero, sizeof(catheader_t)) != sizeof(catheader_t) ||
+     fat_write_file(out, zero, sizeof(zero)) != sizeof(zero))
+    error = 1;
+
+  if(error == 0)
+    scan(root);
+
+  memcpy(h.ident, "CAT\x1A", 4);
+  h.version = CATALOG_VERSION;
+  h.entrysize = sizeof(catentry_t);
+  h.dirs = dirs;
+  h.count = count;
+  if(error || fat_seek_file(out, &at, FAT_SEEK_SET) == 0 ||
+     fat_write_file(out, (u8*)&h, sizeof(h)) != sizeof(h) ||
+     fat_write_file(out, (u8*)stamps, sizeof(stamps)) != sizeof(stamps))
+    error = 1;
+  if(old)
+    fat_close_file(old);
+  fat_close_file(out);
+  old = 0;
+  out = 0;
+
+  //the entry read before the catalog was written has the old size, get it
+  //again before it is renamed.  one that could not be written is dropped,
+  //the old catalog is left and the next boot tries again.
+  if(findentry(root, CATALOG_TMPNAME, &tmpfile)) {
+    tmpfile.attributes |= FAT_ATTRIB_HIDDEN;
+    if(error)
+      fat_delete_file(catfs, &tmpfile);
+    else if((catfound == 0 || fat_delete_file(catfs, &catfile)) &&
+            fat_move_file(catfs, &tmpfile, root, CATALOG_NAME) == 0)
+      error = 1;
+  }
+  sd_raw_sync();
+  fat_reset_dir(root);
+
+  catfound = findentry(root, CATALOG_NAME, &catfile);
+  if(error || catfound == 0)
+    count = 0;
+}
+
+/*
+Open the catalog, checking it against the directories and rebuilding it if
+they have changed.  root is the open root directory.  Returns the number of
+images.
+*/
+u16 catalog_init(struct fat_fs_struct *fs, struct fat_dir_struct *root)
+{
+  catfs = fs;
+  catfound = 0;
+  count = 0;
+  out = 0;
+  old = 0;
+
+  scan(root);
+  if(isvalid() == 0)
+    rebuild(root);
+  return(count);
+}
+
+u16 catalog_count(void)
+{
+  return(count);
+}
+
+//read entry n of the catalog
+u8 catalog_get(u16 n, catentry_t *e)
+{
+  struct fat_file_struct *fd;
+  int32_t at = CATALOG_ENTRIES + (int32_t)n * sizeof(catentry_t);
+  u8 ok;
+
+  if(n >= count || catfound == 0 || (fd = fat_open_file(catfs, &catfile)) == 0)
+    return(0);
+  ok = fat_seek_file(fd, &at, FAT_SEEK_SET) &&
+       fat_read_file(fd, (u8*)e, sizeof(catentry_t)) == sizeof(catentry_t);
+  fat_close_file(fd);
+  return(ok);
+}
+
+//open image n straight from its catalog entry, without a directory search
+struct fat_file_struct *catalog_open(u16 n)
+{
+  struct fat_dir_entry_struct de;
+  catentry_t e;
+
+  if(catalog_get(n, &e) == 0)
+    return(0);
+  memset(&de, 0, sizeof(de));
+  memcpy(de.long_name, e.name, sizeof(de.long_name));
+  de.attributes = e.attributes;
+  de.cluster = e.cluster;
+  de.file_size = e.size;
+  de.entry_offset = e.diroffset;
+  return(fat_open_file(catfs, &de));
+}
@@ -0,0 +1,59 @@
+#ifndef __catalog_h__
+#define __catalog_h__
+
+#include "types.h"
+#include "../lib/sd-reader/fat.h"
+
+/*
+Game library catalog.  Every .fds image in the root directory and the
+directories in it is listed once in a hidden file in the root directory,
+with what is needed to open it without searching for it again, so the card
+is only scanned when its contents change:
+
+  catheader_t
+  catstamp_t x CATALOG_MAXDIRS    root first, then the directories scanned
+  catentry_t x count
+
+Each directory's stamp is made from the cluster, size, entry offset and name
+of every entry in it.  At boot the directories are walked again to remake
+the stamps, without opening any images or reading the catalog entries, and
+if they differ the catalog is rebuilt, scanning only the directories whose
+stamp changed.  The entries of the others are copied over.
+*/
+
+#define CATALOG_NAME        "catalog.idx"
+#define CATALOG_VERSION     2
+
+//directories scanned, the root included
+#define CATALOG_MAXDIRS     8
+
+typedef struct catheader_s {
+  char ident[4];        //"CAT" 0x1A
+  u8 version;
+  u8 entrysize;         //sizeof(catentry_t), it depends on the fat config
+  u8 dirs;
+  u16 count;
+} __attribute__((packed)) catheader_t;
+
+typedef struct catstamp_s {
+  u32 cluster;
+  u32 stamp;
+} __attribute__((packed)) catstamp_t;
+
+typedef struct catentry_s {
+  char name[32];
+  u8 attributes;
+  u8 dir;               //directory it is in, index of its stamp
+  u8 sides;
+  char title[4];        //game name and type from the disk info block
+  u32 cluster;
+  u32 size;
+  offset_t diroffset;   //where the directory entry is on the card
+} __attribute__((packed)) catentry_t;
+
+u16 catalog_init(struct fat_fs_struct *fs, struct fat_dir_struct *root);
+u16 catalog_count(void);
+u8 catalog_get(u16 n, catentry_t *e);
+struct fat_file_struct *catalog_open(u16 n);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef __crc_h__
+#define __crc_h__
+
+#include "types.h"
+
+//crc table size, 256 entries (512 bytes of flash) or 16 (32 bytes, about
+//twice the work per byte).  set in the makefile.
+#ifndef CRC_TABLE
+#define CRC_TABLE       256
+#endif
+
+//add one byte, or len bytes, to the crc
+u16 crc_byte(u16 crc, u8 data);
+u16 crc_update(u16 crc, const u8 *data, u16 len);
+
+#endif
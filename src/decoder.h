@@ -0,0 +1,336 @@
+#ifndef __decoder_h__
+#define __decoder_h__
+
+/*
+Read data decoder.  Turns the intervals between read data edges into bytes
+in a ring of 256 byte slots (see ring.h).  Called once per edge from the capture
+interrupt, so everything here is inline and has no avr dependencies, the
+same code is built into the host replay tool (tools/fluxreplay.c).
+*/
+
+#include "types.h"
+#include "fds.h"
+#include "ring.h"
+
+//number of bits read from the drive before looking for the first block.  the
+//device skips these with a timer before capture starts (see diskdrive.c), the
+//host replay sets skip to it instead.
+#define SKIP_GAP_BITS   14000
+
+//nominal bit rate
+#define BIT_RATE        96400
+
+//bits skipped after each block before looking for the next start mark
+#define BLOCK_SKIP_BITS 480
+
+//intervals this long or longer (in timer ticks) are read as a 1 bit
+#define BIT_THRESHOLD   0x21
+
+/*
+Clock recovery.  The bit cell period is tracked as a running average of the
+short (0 bit) intervals, kept in 1/16 timer ticks, and the threshold follows
+it at the same ratio BIT_THRESHOLD has to the nominal cell:
+
+  cell += (time * 16 - cell) / 16
+  threshold = cell * 51 / 512     (cell / 16 * 1.594)
+
+The cell is held within 20% of nominal so noise in a gap can not run away
+with it.  Long intervals are not averaged in.
+*/
+#define CELL_NOMINAL    332     //20.75 ticks, 2mhz / 96.4khz
+#define CELL_MIN        266
+#define CELL_MAX        398
+
+//dump modes
+#define DUMP_BITS       0   //bits after the first gap, packed msb first
+#define DUMP_FLUX       1   //every read data interval, see below
+#define DUMP_FDS        2   //blocks, lsb first, each one found by its own gap
+
+/*
+Flux dump format (all values little endian):
+
+  fluxhdr_t, then a stream of interval codes
+
+  0x01-0xFF   one interval of this many timer ticks (0xFF = 0xFF or longer)
+  0x00        packed run, followed by:
+                u16 count   number of intervals in the run
+                u8 max      longest interval in the run
+
+A packed run only holds intervals shorter than the threshold (0 bits).  The
+first FLUX_RAWRUN intervals of any such run are always stored as is, so only
+the gap periods get packed in practice.
+*/
+#define FLUX_RAWRUN     32
+
+typedef struct fluxhdr_s {
+  char ident[4];        //"FLX" 0x1A
+  u8 version;
+  u8 flags;             //FLUX_ICP if timed with input capture
+  u32 clock;            //timer clock in hz
+  u8 threshold;         //BIT_THRESHOLD
+  u8 rawrun;            //FLUX_RAWRUN
+  u8 drivestate;        //PINF when the dump started
+  u16 overruns;         //capture ring overruns, filled in when the dump ends
+  u8 highwater;         //most capture ring slots waiting to be written
+} __attribute__((packed)) fluxhdr_t;
+
+#define FLUX_VERSION    1
+#define FLUX_ICP        0x01
+
+typedef struct decoder_s {
+
+  //ring that recieves the decoded data
+  ring_t ring;
+
+  u8 mode;
+
+  //clock recovery: set to track the cell period, the period and the threshold
+  u8 track;
+  u16 cell;
+  u8 threshold;
+
+  //bit mode: bits left to skip, gap flag and the byte being assembled
+  u16 skip;
+  u8 ingap;
+  u8 bufbyte;
+  u8 curbit;
+
+  //fds mode: current block type, position and length (crc included)
+  u8 blocktype;
+  u16 blockpos;
+  u16 blocklen;
+
+  //file size from the last file header block, and blocks read
+  u16 filesize;
+  u8 blocks;
+
+  //flux mode: length of the current run of 0 intervals, and the packed part
+  //of it
+  u8 zerorun;
+  u16 packcount;
+  u8 packmax;
+
+  //total bits read (bitshi counts wraps of bits) and where the first gap ended
+  u16 bits;
+  u8 bitshi;
+  long outgap;
+} decoder_t;
+
+static inline void decoder_init(volatile decoder_t *d, u8 mode)
+{
+  ring_init(&d->ring);
+  d->mode = mode;
+  d->track = 1;
+  d->cell = CELL_NOMINAL;
+  d->threshold = BIT_THRESHOLD;
+
+  //the leading gap is skipped before capture starts
+  d->skip = 0;
+  d->ingap = 1;
+  d->bufbyte = 0;
+  d->curbit = 0;
+  d->blocktype = 0;
+  d->blockpos = 0;
+  d->blocklen = 0;
+  d->filesize = 0;
+  d->blocks = 0;
+  d->zerorun = 0;
+  d->packcount = 0;
+  d->packmax = 0;
+  d->bits = 0;
+  d->bitshi = 0;
+  d->outgap = 0;
+}
+
+//total bits read
+static inline long decoder_bits(volatile decoder_t *d)
+{
+  return(((long)d->bitshi << 16) | d->bits);
+}
+
+//count one bit read, kept to 16 bits in the common case
+static inline void decoder_count(volatile decoder_t *d)
+{
+  if(++d->bits == 0)
+    d->bitshi++;
+}
+
+//put one byte into the ring
+static inline void decoder_put(volatile decoder_t *d, u8 data)
+{
+  ring_putbyte(&d->ring, data);
+}
+
+//write out the packed part of the current run of 0 intervals
+static inline void decoder_flushrun(volatile decoder_t *d)
+{
+  if(d->packcount) {
+    decoder_put(d, 0x00);
+    decoder_put(d, (u8)d->packcount);
+    decoder_put(d, (u8)(d->packcount >> 8));
+    decoder_put(d, d->packmax);
+    d->packcount = 0;
+    d->packmax = 0;
+  }
+}
+
+//flux mode: store the interval, packing long runs of 0 intervals
+static inline void decoder_flux(volatile decoder_t *d, u8 time)
+{
+  //0 bit, extend the current run
+  if(time < BIT_THRESHOLD) {
+    if(d->zerorun < FLUX_RAWRUN)
+      d->zerorun++;
+
+    //the first part of the run is stored as is
+    else {
+      if(time > d->packmax)
+        d->packmax = time;
+      if(++d->packcount == 0xFFFF)
+        decoder_flushrun(d);
+      return;
+    }
+  }
+
+  //1 bit, end the run
+  else {
+    decoder_flushrun(d);
+    d->zerorun = 0;
+  }
+
+  decoder_put(d, time ? time : 1);
+}
+
+//block end, skip past the crc and look for the next gap
+static inline void decoder_endblock(volatile decoder_t *d)
+{
+  d->ingap = 1;
+  d->skip = BLOCK_SKIP_BITS;
+}
+
+//fds mode: keep track of where the current block ends
+static inline void decoder_block(volatile decoder_t *d, u8 data)
+{
+  u16 pos = d->blockpos++;
+
+  //first byte is the block type, and gives the length
+  if(pos == 0) {
+    d->blocktype = data;
+    d->blocklen = fds_blocksize(data, d->filesize) + 2;
+
+    //not a block, resync on the next gap
+    if(d->blocklen == 2) {
+      decoder_endblock(d);
+      return;
+    }
+  }
+
+  //file data block length comes from the file header
+  else if(d->blocktype == FDS_FILEHEADER) {
+    if(pos == FDS_FILESIZE_POS)
+      d->filesize = data;
+    else if(pos == FDS_FILESIZE_POS + 1)
+      d->filesize |= (u16)data << 8;
+  }
+
+  if(d->blockpos == d->blocklen) {
+    d->blocks++;
+    decoder_endblock(d);
+  }
+}
+
+//follow the cell period with a short interval
+static inline void decoder_track(volatile decoder_t *d, u8 time)
+{
+  u16 cell = d->cell;
+
+  cell += ((s16)((u16)time << 4) - (s16)cell) >> 4;
+  if(cell < CELL_MIN)
+    cell = CELL_MIN;
+  else if(cell > CELL_MAX)
+    cell = CELL_MAX;
+  d->cell = cell;
+  d->threshold = (u16)(cell * 51) >> 9;
+}
+
+//a whole byte of a block has been read
+static inline void decoder_byte(volatile decoder_t *d, u8 data)
+{
+  decoder_put(d, data);
+  if(d->mode == DUMP_FDS)
+    decoder_block(d, data);
+}
+
+//process one read data edge, time is the interval since the last edge
+static inline void decoder_edge(volatile decoder_t *d, u8 time)
+{
+  u8 bit = 0;
+
+  if(d->mode == DUMP_FLUX) {
+    decoder_flux(d, time);
+    decoder_count(d);
+    return;
+  }
+
+  if(time >= d->threshold)
+    bit = 1;
+  else if(d->track)
+    decoder_track(d, time);
+
+  //skip the leading gap, or the crc and gap after a block
+  if(d->skip) {
+    d->skip--;
+    decoder_count(d);
+    return;
+  }
+
+  //if this is a gap period, wait for block start mark
+  if(d->ingap) {
+
+    //if this is a 1 then block is starting
+    if(bit) {
+      if(d->outgap == 0)
+        d->outgap = decoder_bits(d);
+      d->ingap = 0;
+      d->curbit = 0;
+      d->blockpos = 0;
+    }
+  }
+
+  //fds blocks are sent lsb first
+  else if(d->mode == DUMP_FDS) {
+    d->bufbyte = (d->bufbyte >> 1) | (bit << 7);
+    d->curbit++;
+
+    if(d->curbit == 8) {
+      d->curbit = 0;
+      decoder_byte(d, d->bufbyte);
+    }
+  }
+
+  //not in gap, we are receiving data
+  else {
+    d->bufbyte = (d->bufbyte << 1) | bit;
+    d->curbit++;
+
+    //if this is the eighth bit, put byte into buffer
+    if(d->curbit == 8) {
+      d->curbit = 0;
+      decoder_byte(d, d->bufbyte);
+    }
+  }
+
+  decoder_count(d);
+}
+
+//call once the capture has stopped.  flushes anything still held by the
+//decoder and returns the partly filled slot, drain the full ones first.
+static inline volatile u8 *decoder_finish(volatile decoder_t *d, u8 *len)
+{
+  if(d->mode == DUMP_FLUX)
+    decoder_flushrun(d);
+  *len = d->ring.wpos;
+  return(d->ring.slot[d->ring.head]);
+}
+
+#endif
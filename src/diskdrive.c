@@ -0,0 +1,326 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "diskdrive.h"
+
+/*
+pin config:
+
+stop motor    = f0 (input)  (active low)
+media set     = f1 (output) (active low)
+batt/motor on = f2 (output)
+ready         = f3 (output) (active low)
+read data     = f4 (output)
+rw media      = f5 (output) (active low)
+write         = f6 (input)
+scan media    = f7 (input)  (active low)
+write data    = e5 (input)  (active low)
+
+read data is also wired to e4 (int4), or to d4 (icp1) when built with
+CAPTURE_ICP=1.  the nes pad moves to port a in that case.
+
+write data was on d5 on the original board.  it is wired to e5 now, so the
+ram adapter can time writes with int5 and timer3, and d5 is free for the
+usart clock (RA_USART=1).  the drive only gets it held high (inactive).
+*/
+
+/*
+Read data is timed in units of the timer clock, 16mhz / 8 = 2mhz.
+
+16mhz / 8 / 96.4khz = 20.746887966804979253112033195021
+
+With CAPTURE_ICP=0, timer0 is read and cleared inside the int4 handler, so
+the interrupt entry latency ends up in every interval.  With CAPTURE_ICP=1,
+timer1 runs free and the input capture unit latches the edge time in
+hardware, the handler only has to subtract the previous timestamp.
+
+The leading gap is not counted edge by edge.  When the drive gets ready,
+timer3 is started as a one shot at 16mhz / 64 = 250khz and the read data
+interrupt is only enabled once the compare match says SKIP_GAP_BITS worth of
+time has gone by.  Flux dumps keep the whole gap and start capturing at once.
+*/
+
+//timer3 ticks in the leading gap
+#define GAP_TICKS       ((u16)((F_CPU / 64) * SKIP_GAP_BITS / BIT_RATE))
+
+volatile decoder_t decoder;
+
+volatile u8 started = 0;
+
+#if CAPTURE_ICP
+//timestamp of the previous read data edge
+static u16 lasttime;
+#endif
+
+static inline void capture_enable(void)
+{
+#if CAPTURE_ASM
+  GPIOR0 = 0;               //start in the c decoder
+#endif
+#if CAPTURE_ICP
+  lasttime = TCNT1;
+  TIFR1 = (1 << ICF1);      //clear stale capture
+  TIMSK1 |= (1 << ICIE1);   //enable input capture interrupt
+#else
+  EIMSK |= (1 << INT4);     //enable INT4
+  TCNT0 = 0;
+  TIFR0 = (1 << TOV0);      //clear stale overflow
+#endif
+}
+
+static inline void capture_disable(void)
+{
+#if CAPTURE_ICP
+  TIMSK1 &= ~(1 << ICIE1);  //disable input capture interrupt
+#else
+  EIMSK &= ~(1 << INT4);    //disable INT4
+#endif
+}
+
+//start the one shot that ends the leading gap
+static inline void gap_arm(void)
+{
+  TCCR3B = 0x00;
+  TCNT3 = 0;
+  OCR3A = GAP_TICKS;
+  TIFR3 = (1 << OCF3A);     //clear stale compare match
+  TIMSK3 = (1 << OCIE3A);   //enable compare match a interrupt
+  TCCR3B = 0x03;            //div by 64 prescaler, start
+}
+
+static inline void gap_disarm(void)
+{
+  TCCR3B = 0x00;
+  TIMSK3 = 0x00;
+}
+
+//external interrupt tied to change of signal connected to d0 (reset, active low)
+ISR(INT0_vect)
+{
+  //if disk drive is ready and a read was asked for, start capturing data once
+  //past the leading gap
+  if(is_ready() && started) {
+    if(decoder.mode == DUMP_FLUX)
+      capture_enable();
+    else
+      gap_arm();
+  }
+
+  //disk drive no longer ready, transfer complete
+  else {
+    gap_disarm();
+    capture_disable();
+    started = 0;
+  }
+}
+
+//leading gap is over
+ISR(TIMER3_COMPA_vect)
+{
+  gap_disarm();
+  capture_enable();
+}
+
+#if CAPTURE_ICP
+//input capture on d4 (read data), ICR1 holds the time of the rising edge
+ISR(TIMER1_CAPT_vect)
+{
+  u16 now = ICR1;
+  u16 time = now - lasttime;
+
+  lasttime = now;
+  decoder_edge(&decoder, time > 0xFF ? 0xFF : (u8)time);
+}
+#elif CAPTURE_ASM
+//the int4 handler is in capture.S, these are the parts of it done in c
+
+volatile u16 capture_trksum;
+volatile u8 capture_trkcount;
+
+//hand the bits to the assembler while the decoder is inside a block
+static inline void capture_sync(void)
+{
+  volatile decoder_t *d = &decoder;
+  u8 lsb = (d->mode == DUMP_FDS) ? (1 << CAPTURE_LSB) : 0;
+
+  if(d->mode == DUMP_FLUX || d->ingap || d->skip) {
+    GPIOR0 = 0;
+    return;
+  }
+  GPIOR2 = d->threshold - 1;
+  if((GPIOR0 & (1 << CAPTURE_FAST)) == 0) {
+    GPIOR1 = lsb ? 0x80 : 0x01;
+    capture_trksum = 0;
+    capture_trkcount = 0;
+    GPIOR0 = (1 << CAPTURE_FAST) | lsb;
+  }
+}
+
+//an edge outside of a block
+void capture_edge(u8 time)
+{
+  decoder_edge(&decoder, time);
+  capture_sync();
+}
+
+//a byte assembled by capture.S
+void capture_byte(u8 data)
+{
+  volatile decoder_t *d = &decoder;
+  u16 sum = capture_trksum;
+  u8 n = capture_trkcount;
+
+  capture_trksum = 0;
+  capture_trkcount = 0;
+
+  //the next edge is due before this is done, let it in
+  sei();
+  if(d->track && n) {
+    u8 time = sum / n;
+
+    while(n--)
+      decoder_track(d, time);
+  }
+  decoder_byte(d, data);
+  if((d->bits += 8) < 8)
+    d->bitshi++;
+  cli();
+
+  capture_sync();
+}
+#else
+//external interrupt tied to rise of signal connected to e4 (read data)
+ISR(INT4_vect)
+{
+  u8 time = TCNT0;
+
+  TCNT0 = 0;
+
+  //timer0 wrapped since the last edge, the interval is 0xFF or longer
+  if(TIFR0 & (1 << TOV0)) {
+    TIFR0 = (1 << TOV0);
+    time = 0xFF;
+  }
+  decoder_edge(&decoder, time);
+}
+#endif
+
+static void timeunit_init(void)
+{
+#if CAPTURE_ICP
+  //timer1 free running for input capture on the rising edge
+  TCCR1A = 0x00;
+  TCCR1B = (1 << ICNC1) | (1 << ICES1) | 0x02;  //noise canceler, div by 8
+  TIMSK1 = 0x00;
+#else
+  //initialize time unit (for receiving data from the disk drive)
+  TCCR0A = 0x00;      //disable unused features
+  TCCR0B = 0x02;      //div by 8 prescaler
+  TIMSK0 = 0x00;      //disable interrupts
+#endif
+
+  //timer3 stopped until the drive is ready
+  TCCR3A = 0x00;
+  gap_disarm();
+}
+
+void diskdrive_init(void)
+{
+  //set port input/outputs
+  DDRF = 0xC1;
+  DDRE |= 0x20;
+
+  //enable pullups
+  PORTF = 0x3E;
+
+  //default values
+  PORTE |= 0x20;
+  PORTF = 0x80;
+
+#if CAPTURE_ICP
+  //d4 as input (icp1 for read data)
+  DDRD &= ~0x10;
+  PORTD |= 0x10;
+#else
+  //e4 as input (irq for read data)
+  DDRE &= ~0x10;
+  PORTE |= 0x10;
+#endif
+
+  //d0 as input (irq for ready change)
+  DDRD &= ~0x01;
+  PORTD |= 0x01;
+
+  //external interrupts
+  EIMSK = 0x00;     //disable all external interrupts
+  EICRA = 0x01;     //set INT0 to trigger with level change
+  EICRB = 0x03;     //set INT4 to trigger with 0->1
+  EIMSK = 0x01;     //enable INT0, disable INT4
+
+  timeunit_init();
+  decoder_init(&decoder, DUMP_BITS);
+}
+
+//stop the motor and release scan media
+void diskdrive_stop(void)
+{
+  PORTF &= ~0x01;
+  PORTF |= 0x80;
+}
+
+//stop the motor and turn the drive's interrupts off, the connector is handed
+//to the ram adapter until diskdrive_init is called again
+void diskdrive_release(void)
+{
+  diskdrive_stop();
+  started = 0;
+  EIMSK &= ~((1 << INT0) | (1 << INT4));
+#if CAPTURE_ICP
+  TIMSK1 = 0x00;
+#endif
+  gap_disarm();
+}
+
+//restart the motor and begin reading from the start of the disk
+void diskdrive_start(u8 mode)
+{
+  diskdrive_stop();
+  decoder_init(&decoder, mode);
+  _delay_ms(50);
+  PORTF |= 0x01;
+  PORTF &= ~0x80;
+  started = 1;
+}
+
+//keep the motor running and capture the next time the drive gets ready.
+//if the drive is already ready again, the start of the disk was missed and
+//the motor is restarted instead.
+void diskdrive_next(u8 mode)
+{
+  cli();
+  if(is_ready()) {
+    sei();
+    diskdrive_start(mode);
+    return;
+  }
+  decoder_init(&decoder, mode);
+  started = 1;
+  sei();
+}
+
+//fill in the header for a flux dump file
+void diskdrive_fluxheader(fluxhdr_t *hdr)
+{
+  hdr->ident[0] = 'F';
+  hdr->ident[1] = 'L';
+  hdr->ident[2] = 'X';
+  hdr->ident[3] = 0x1A;
+  hdr->version = FLUX_VERSION;
+  hdr->flags = CAPTURE_ICP ? FLUX_ICP : 0;
+  hdr->clock = TIMER_CLOCK;
+  hdr->threshold = BIT_THRESHOLD;
+  hdr->rawrun = FLUX_RAWRUN;
+  hdr->drivestate = PINF;
+  hdr->overruns = 0;
+  hdr->highwater = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __diskdrive_h__
+#define __diskdrive_h__
+
+#include "types.h"
+#include "decoder.h"
+#include "capture.h"
+
+#define is_mediaset()   ((PINF & 0x02) == 0)
+#define is_motoron()    ((PINF & 0x04) != 0)
+#define is_ready()      ((PINF & 0x08) == 0)
+#define is_writable()   ((PINF & 0x10) == 0)
+
+//read data timer clock
+#define TIMER_CLOCK     (F_CPU / 8)
+
+//the decoder fed by the read data interrupt
+extern volatile decoder_t decoder;
+
+//set while the drive is ready and being read
+extern volatile u8 started;
+
+void diskdrive_init(void);
+void diskdrive_start(u8 mode);
+void diskdrive_stop(void);
+void diskdrive_release(void);
+void diskdrive_next(u8 mode);
+void diskdrive_fluxheader(fluxhdr_t *hdr);
+
+#endif
@@ -0,0 +1,511 @@
+#include <string.h>
+#include "fds.h"
+#include "crc.h"
+#include "flashstore.h"
+#include "../lib/sd-reader/fat.h"
+
+//write part of a block to the image
+static u8 writeimage(fdswriter_t *w, const u8 *data, u16 len)
+{
+  if(len == 0)
+    return(1);
+
+  //never write past the end of the side
+  if(w->at + (u32)len > FDS_SIDESIZE)
+    len = FDS_SIDESIZE - w->at;
+  if(fat_write_file(w->fd, data, len) != len) {
+    w->error = 1;
+    return(0);
+  }
+  w->at += len;
+  if(w->at > w->size)
+    w->size = w->at;
+  return(1);
+}
+
+//move to another place in the side
+static u8 seekimage(fdswriter_t *w, u16 to)
+{
+  int32_t offset = FDS_HEADERSIZE + (u32)to;
+
+  if(to == w->at)
+    return(1);
+  if(fat_seek_file(w->fd, &offset, FAT_SEEK_SET) == 0) {
+    w->error = 1;
+    return(0);
+  }
+  w->at = to;
+  return(1);
+}
+
+//write zeros up to a place in the side
+static u8 padimage(fdswriter_t *w, u16 to)
+{
+  u8 zero[32];
+
+  memset(zero, 0, sizeof(zero));
+  while(w->error == 0 && w->at < to) {
+    u16 len = to - w->at;
+
+    if(!writeimage(w, zero, len > sizeof(zero) ? sizeof(zero) : len))
+      return(0);
+  }
+  return(w->error == 0);
+}
+
+//where a slot belongs: after all the slots before it, if some pass has read
+//every one of them.  -1 if that is not known yet.
+static s32 slotoffset(fdswriter_t *w, u8 slot)
+{
+  u32 offset = 0;
+  u8 i;
+
+  if(slot == FDS_NOSLOT || (slot && w->table == 0))
+    return(-1);
+  for(i = 0; i < slot; i++) {
+    if(w->table[i].seen == 0)
+      return(-1);
+    offset += w->table[i].size;
+  }
+  return(offset);
+}
+
+/*
+Put the block just started at the place for its slot.  That is after the
+slots before it, else where an earlier pass had this slot, else right after
+the last block of this pass.  Every pass lays the blocks down at the same
+offsets that way, even if it misses one that another pass read.
+*/
+static u8 placeblock(fdswriter_t *w)
+{
+  s32 to = slotoffset(w, w->slot);
+
+  if(to < 0 && w->table && w->slot != FDS_NOSLOT && w->table[w->slot].seen)
+    to = w->table[w->slot].offset;
+  if(to < 0)
+    to = w->at;
+  if(to > FDS_SIDESIZE)
+    to = FDS_SIDESIZE;
+
+  w->start = to;
+  if(to > w->size)
+    return(seekimage(w, w->size) && padimage(w, to));
+  return(seekimage(w, to));
+}
+
+//slot of a block from its type, the file number is from the header before it
+static u8 blockslot(fdswriter_t *w, u8 type)
+{
+  u16 slot;
+
+  switch(type) {
+    case FDS_DISKINFO:    return(0);
+    case FDS_FILEAMOUNT:  return(1);
+    case FDS_FILEHEADER:  slot = 2 + 2 * (u16)w->file; break;
+    case FDS_FILEDATA:    slot = 3 + 2 * (u16)w->file; break;
+    default:              return(FDS_NOSLOT);
+  }
+  if(w->file == FDS_NOFILE || slot >= FDS_MAXBLOCKS)
+    return(FDS_NOSLOT);
+  return(slot);
+}
+
+//note where the block just read ended up in the image
+static void recordblock(fdswriter_t *w, u8 ok)
+{
+  fdsblock_t *b;
+  s32 want;
+
+  if(w->table == 0 || w->slot == FDS_NOSLOT)
+    return;
+  b = &w->table[w->slot];
+  want = slotoffset(w, w->slot);
+
+  //the first copy read sets where the block belongs.  a copy right after
+  //the slots before it moves an entry that was put down before they were
+  //all known, and a later copy with a good crc wins over one without.
+  if(b->seen == 0 || (want >= 0 && w->start == want && b->offset != want) ||
+     (ok && b->crcok == 0 && (b->offset != w->start || b->size != w->len))) {
+    b->offset = w->start;
+    b->size = w->len;
+    b->type = w->type;
+    b->seen = 0;
+    b->crcok = 0;
+  }
+
+  if(b->offset == w->start && b->size == w->len) {
+    b->seen |= 1 << w->pass;
+    if(ok)
+      b->crcok |= 1 << w->pass;
+  }
+  if(w->slot >= w->slots)
+    w->slots = w->slot + 1;
+}
+
+//start a .fds image with a one sided header.  if table is given, every block
+//read is entered into it for pass number pass.
+u8 fds_writer_open(fdswriter_t *w, struct fat_file_struct *fd, fdsblock_t *table, u8 pass)
+{
+  u8 header[FDS_HEADERSIZE];
+
+  memset(w, 0, sizeof(fdswriter_t));
+  w->fd = fd;
+  w->table = table;
+  w->pass = pass;
+  w->file = FDS_NOFILE;
+
+  memset(header, 0, sizeof(header));
+  header[0] = 'F';
+  header[1] = 'D';
+  header[2] = 'S';
+  header[3] = 0x1A;
+  header[4] = 1;
+  if(fat_write_file(fd, header, sizeof(header)) != sizeof(header)) {
+    w->error = 1;
+    return(0);
+  }
+  return(1);
+}
+
+/*
+Feed decoded bytes to the writer.  The bytes are the blocks exactly as read,
+type byte first and crc last, back to back.  The block data goes to the
+image and the crc bytes are only checked.  A byte that does not start a
+known block type is dropped, the decoder goes back to looking for a gap
+after it as well.
+
+Each block goes in the table slot for its place on the side, so the passes
+line up block for block.  A file header is only placed once its file number
+is in, its type byte is held back until then.  A data block is only given a
+slot right after the header of its file.
+*/
+u8 fds_writer_data(fdswriter_t *w, const u8 *data, u16 len)
+{
+  const u8 *span = data;
+  u16 i;
+
+  for(i = 0; i < len; i++) {
+    u8 b = data[i];
+
+    //start of a block
+    if(w->pos == 0) {
+      w->type = b;
+      w->len = fds_blocksize(b, w->filesize);
+      if(!writeimage(w, span, &data[i] - span))
+        return(0);
+      if(w->len == 0) {
+        span = &data[i + 1];
+        continue;
+      }
+      w->crc = FDS_CRC_INIT;
+      if(b == FDS_FILEHEADER)
+        span = &data[i + 1];
+      else {
+        w->slot = blockslot(w, b);
+        if(!placeblock(w))
+          return(0);
+      }
+      w->file = FDS_NOFILE;
+    }
+
+    //file number, the header can be placed now
+    else if(w->type == FDS_FILEHEADER && w->pos == FDS_FILENUM_POS) {
+      u8 type = FDS_FILEHEADER;
+
+      w->file = (b >= w->nextfile && b != FDS_NOFILE) ? b : FDS_NOFILE;
+      w->slot = blockslot(w, FDS_FILEHEADER);
+      if(!placeblock(w) || !writeimage(w, &type, 1))
+        return(0);
+      span = &data[i];
+    }
+
+    //remember the file size for the following data block
+    if(w->type == FDS_FILEHEADER) {
+      if(w->pos == FDS_FILESIZE_POS)
+        w->filesize = b;
+      else if(w->pos == FDS_FILESIZE_POS + 1)
+        w->filesize |= (u16)b << 8;
+    }
+
+    w->crc = crc_byte(w->crc, b);
+    w->pos++;
+
+    //first crc byte, the block data ends here
+    if(w->pos == w->len + 1) {
+      if(!writeimage(w, span, &data[i] - span))
+        return(0);
+    }
+
+    //last crc byte, the crc of the block and its crc comes out as 0
+    else if(w->pos == w->len + 2) {
+      recordblock(w, w->crc == 0);
+
+      //files come in order, a later header can not go back to this one
+      if(w->type == FDS_FILEHEADER && w->crc == 0 && w->file != FDS_NOFILE)
+        w->nextfile = w->file + 1;
+      w->blocks++;
+      if(w->crc != 0)
+        w->crcerrors++;
+      w->pos = 0;
+      span = &data[i + 1];
+    }
+  }
+
+  //write whatever block data is left
+  if(w->pos <= w->len)
+    return(writeimage(w, span, &data[len] - span));
+  return(1);
+}
+
+//pad the side out to its full size
+u8 fds_writer_close(fdswriter_t *w)
+{
+  if(w->error)
+    return(0);
+  return(seekimage(w, w->size) && padimage(w, FDS_SIDESIZE));
+}
+
+//reader states
+#define R_GAP     0
+#define R_MARK    1
+#define R_DATA    2
+#define R_CRCLO   3
+#define R_CRCHI   4
+#define R_END     5
+
+//next byte of the side, or -1 at the end of it
+static s16 readimage(fdsreader_t *r)
+{
+  if(r->inpos == r->inlen) {
+    intptr_t len;
+
+    if(r->sidepos >= FDS_SIDESIZE)
+      return(-1);
+    len = FDS_SIDESIZE - r->sidepos;
+    if(len > (intptr_t)sizeof(r->in))
+      len = sizeof(r->in);
+    if(r->fd == 0)
+      flashstore_read(r->start + r->sidepos, r->in, len);
+    else if((len = fat_read_file(r->fd, r->in, len)) <= 0)
+      return(-1);
+    if(r->patch)
+      r->patch(r->start + r->sidepos, r->in, len);
+    r->sidepos += len;
+    r->inlen = len;
+    r->inpos = 0;
+  }
+  return(r->in[r->inpos++]);
+}
+
+//image offset of the next byte readimage returns
+static u32 imagepos(fdsreader_t *r)
+{
+  return(r->start + r->sidepos - r->inlen + r->inpos);
+}
+
+//read the type of the next block, or end the disk if there is none.  stream
+//is where its gap starts in the bytes sent.
+static void nextblock(fdsreader_t *r, u16 gap, u32 stream)
+{
+  fdsmark_t *m = &r->mark[r->marks++ % FDS_MARKS];
+  s16 type = readimage(r);
+
+  m->stream = stream;
+  m->filesize = r->filesize;
+  if(type < 0 || fds_blocksize((u8)type, r->filesize) == 0) {
+    m->offset = imagepos(r) - (type >= 0);
+    m->type = 0;
+    r->state = R_END;
+    return;
+  }
+  m->offset = imagepos(r) - 1;
+  m->type = (u8)type;
+  r->type = (u8)type;
+  r->state = gap ? R_GAP : R_MARK;
+  r->count = gap;
+}
+
+/*
+Index the sides of a .fds image (with or without the 16 byte header).  Every
+side that is all there and starts with a disk info block is entered, with the
+cluster its first byte is in.  Returns the number of sides, 0 if the file
+does not look like an image.
+*/
+u8 fds_index(fdsindex_t *x, struct fat_file_struct *fd)
+{
+  u8 header[FDS_HEADERSIZE];
+  int32_t offset = 0;
+  uint32_t at;
+  cluster_t cluster;
+
+  memset(x, 0, sizeof(fdsindex_t));
+  x->fd = fd;
+  if(fat_seek_file(fd, &offset, FAT_SEEK_SET) == 0)
+    return(0);
+  if(fat_read_file(fd, header, sizeof(header)) == sizeof(header) && memcmp(header, "FDS\x1A", 4) == 0)
+    offset = FDS_HEADERSIZE;
+
+  while(x->sides < FDS_MAXSIDES) {
+    int32_t end = offset + FDS_SIDESIZE - 1;
+    u8 type;
+
+    //the whole side has to be there
+    if(fat_seek_file(fd, &end, FAT_SEEK_SET) == 0 || fat_read_file(fd, &type, 1) != 1)
+      break;
+
+    //and start with the disk info block
+    end = offset;
+    if(fat_seek_file(fd, &end, FAT_SEEK_SET) == 0 || fat_tell_file(fd, &at, &cluster) == 0)
+      break;
+    if(fat_read_file(fd, &type, 1) != 1 || type != FDS_DISKINFO)
+      break;
+
+    x->offset[x->sides] = at;
+    x->cluster[x->sides] = cluster;
+    x->sides++;
+    offset += FDS_SIDESIZE;
+  }
+  return(x->sides);
+}
+
+//index an image in flash, its sides follow each other with no header
+u8 fds_index_flash(fdsindex_t *x, const flashimage_t *img)
+{
+  u8 type;
+
+  memset(x, 0, sizeof(fdsindex_t));
+  while(x->sides < FDS_MAXSIDES && (u32)(x->sides + 1) * FDS_SIDESIZE <= img->size) {
+    u32 at = img->addr + (u32)x->sides * FDS_SIDESIZE;
+
+    flashstore_read(at, &type, 1);
+    if(type != FDS_DISKINFO)
+      break;
+    x->offset[x->sides++] = at;
+  }
+  return(x->sides);
+}
+
+//read len bytes from pos in a side of an indexed image, for a look at its
+//disk info block.  the file position is left after them.
+u8 fds_read_side(const fdsindex_t *x, u8 side, u16 pos, u8 *data, u8 len)
+{
+  if(side >= x->sides)
+    return(0);
+  if(x->fd == 0) {
+    flashstore_read(x->offset[side] + pos, data, len);
+    return(1);
+  }
+  return(fat_seek_file_cluster(x->fd, x->offset[side] + pos, x->cluster[side]) &&
+         fat_read_file(x->fd, data, len) == len);
+}
+
+/*
+Start reading a side of an indexed image from its beginning.  leadgap is the
+number of gap bytes to send before the first block, blockgap the number
+between blocks.  patch (or 0) is given every piece of the image as it is
+read.  Returns 0 if there is no such side.
+*/
+u8 fds_reader_open(fdsreader_t *r, const fdsindex_t *x, u8 side, u16 leadgap, u8 blockgap, fdspatch_t patch)
+{
+  memset(r, 0, sizeof(fdsreader_t));
+  r->fd = x->fd;
+  r->blockgap = blockgap;
+  r->patch = patch;
+  r->state = R_END;
+  if(side >= x->sides)
+    return(0);
+  if(r->fd && fat_seek_file_cluster(r->fd, x->offset[side], x->cluster[side]) == 0)
+    return(0);
+  r->start = x->offset[side];
+
+  //the first block is the disk info block, the index checked it
+  nextblock(r, leadgap, 0);
+  return(r->state != R_END);
+}
+
+/*
+Fill data with the next len bytes of the disk.  Returns the number of bytes
+put in data, less than len once the last block has been sent.
+*/
+u16 fds_reader_read(fdsreader_t *r, u8 *data, u16 len)
+{
+  u16 n;
+
+  for(n = 0; n < len; n++) {
+    u8 b;
+
+    switch(r->state) {
+      case R_GAP:
+        b = 0;
+        if(--r->count == 0)
+          r->state = R_MARK;
+        break;
+
+      case R_MARK:
+        b = FDS_STARTMARK;
+        r->state = R_DATA;
+        r->count = fds_blocksize(r->type, r->filesize);
+        r->crc = FDS_CRC_INIT;
+        break;
+
+      case R_DATA: {
+        u16 pos = fds_blocksize(r->type, r->filesize) - r->count;
+        s16 c = (pos == 0) ? r->type : readimage(r);
+
+        //image ended inside a block, send it padded
+        b = (c < 0) ? 0 : (u8)c;
+
+        //remember the file size for the following data block
+        if(r->type == FDS_FILEHEADER) {
+          if(pos == FDS_FILESIZE_POS)
+            r->filesize = b;
+          else if(pos == FDS_FILESIZE_POS + 1)
+            r->filesize |= (u16)b << 8;
+        }
+
+        r->crc = crc_byte(r->crc, b);
+        if(--r->count == 0) {
+          r->crc = crc_byte(crc_byte(r->crc, 0), 0);
+          r->state = R_CRCLO;
+        }
+        break;
+      }
+
+      case R_CRCLO:
+        b = (u8)r->crc;
+        r->state = R_CRCHI;
+        break;
+
+      case R_CRCHI:
+        b = (u8)(r->crc >> 8);
+        nextblock(r, r->blockgap, r->stream + n + 1);
+        break;
+
+      default:
+        r->stream += n;
+        return(n);
+    }
+    data[n] = b;
+  }
+  r->stream += n;
+  return(n);
+}
+
+/*
+Find the block the head is at, given how many bytes of the disk have gone
+out: the last one whose gap started at or before stream.  This is the block
+a write starting there replaces, or where a new block goes if it is the end
+mark (type 0).  Returns 0 if stream is further back than the marks go.
+*/
+const fdsmark_t *fds_reader_locate(fdsreader_t *r, u32 stream)
+{
+  u8 i;
+
+  for(i = 1; i <= FDS_MARKS && i <= r->marks; i++) {
+    const fdsmark_t *m = &r->mark[(u8)(r->marks - i) % FDS_MARKS];
+
+    if(m->stream <= stream)
+      return(m);
+  }
+  return(0);
+}
@@ -0,0 +1,192 @@
+#ifndef __fds_h__
+#define __fds_h__
+
+#include "types.h"
+
+/*
+Disk side layout, as stored in a .fds image (the on disk copy adds a gap and
+start mark before each block and a crc after it):
+
+  block 1   disk info       56 bytes
+  block 2   file amount      2 bytes
+  block 3   file header     16 bytes, file size at offset 13 (little endian)
+  block 4   file data        1 + file size bytes
+
+blocks 3 and 4 repeat for every file.  every block starts with its type byte.
+*/
+
+#define FDS_DISKINFO        1
+#define FDS_FILEAMOUNT      2
+#define FDS_FILEHEADER      3
+#define FDS_FILEDATA        4
+
+//offset of the file number and the file size in the file header block
+#define FDS_FILENUM_POS     1
+#define FDS_FILESIZE_POS    13
+
+//offset of the game name (3 characters) and game type in the disk info block
+#define FDS_TITLE_POS       16
+
+//size of one disk side in a .fds image, and the optional header before it
+#define FDS_SIDESIZE        65500
+#define FDS_HEADERSIZE      16
+
+//crc register value at the start of a block, the start mark is included
+#define FDS_CRC_INIT        0x8000
+
+//gaps on the disk, in bytes of 0 bits: before the first block and between
+//blocks.  the start mark is a byte of 0x80 (sent lsb first) after each gap.
+#define FDS_GAP_FIRST       (28300 / 8)
+#define FDS_GAP_BLOCK       (976 / 8)
+#define FDS_STARTMARK       0x80
+
+//returns the size of a block (type byte included, crc not) or 0 if type is
+//not a block type.  filesize is from the last file header block.
+static inline u16 fds_blocksize(u8 type, u16 filesize)
+{
+  switch(type) {
+    case FDS_DISKINFO:    return(56);
+    case FDS_FILEAMOUNT:  return(2);
+    case FDS_FILEHEADER:  return(16);
+    case FDS_FILEDATA:    return(1 + filesize);
+  }
+  return(0);
+}
+
+struct fat_file_struct;
+
+//most blocks a side can hold in the block table.  a block goes in the slot
+//for its place on the side: disk info in 0, file amount in 1, then the header
+//and data of file n in 2 + 2n and 3 + 2n.
+#define FDS_MAXBLOCKS       128
+#define FDS_NOSLOT          0xFF
+#define FDS_NOFILE          0xFF
+
+//where a block was written in the image, and which passes read it there
+typedef struct fdsblock_s {
+  u16 offset;
+  u16 size;
+  u8 type;
+  u8 seen;        //bit n set if pass n had the block at this offset
+  u8 crcok;       //bit n set if that copy also passed the crc check
+  u8 agree;       //filled in by the merge, percent of bytes all copies agreed on
+} fdsblock_t;
+
+//writes decoded blocks to a .fds image, checking the crc of each block
+typedef struct fdswriter_s {
+  struct fat_file_struct *fd;
+
+  //block table to fill in (or 0) and the pass number for it
+  fdsblock_t *table;
+  u8 pass;
+
+  //current block and where it starts in the image
+  u8 type;
+  u16 start;
+  u16 pos;
+  u16 len;
+  u16 crc;
+
+  //file size from the last file header block
+  u16 filesize;
+
+  //file number the next data block belongs to (or FDS_NOFILE), the lowest
+  //file number the next header can have (from the last one with a good crc)
+  //and the table slot of this block
+  u8 file;
+  u8 nextfile;
+  u8 slot;
+
+  //where the next byte goes in the side, and side bytes written so far
+  u16 at;
+  u16 size;
+
+  //blocks seen, table slots up to the last one filled in, and how many of
+  //the blocks failed the crc check
+  u8 blocks;
+  u8 slots;
+  u8 crcerrors;
+  u8 error;
+} fdswriter_t;
+
+//called with image data as it is read, to lay unsaved writes over it
+typedef void (*fdspatch_t)(u32 offset, u8 *data, u16 len);
+
+//recent block starts kept by the reader, enough to cover what it is ahead of
+//the head by (the playback ring) with the shortest blocks
+#define FDS_MARKS           8
+
+//a block start: where its gap begins in the bytes sent, where its type byte
+//is in the image (or where a new block would go, type 0) and the file size
+//in effect for it
+typedef struct fdsmark_s {
+  u32 stream;
+  u32 offset;
+  u16 filesize;
+  u8 type;
+} fdsmark_t;
+
+//most sides indexed in an image
+#define FDS_MAXSIDES        8
+
+/*
+Where every side of an image starts, found once when the image is chosen:
+the offset of the side in the file and the cluster that offset is in, so
+changing sides is a seek to a known cluster instead of a walk down the fat
+chain.  For an image in flash fd is 0 and the offsets are flash addresses.
+*/
+typedef struct fdsindex_s {
+  struct fat_file_struct *fd;
+  u8 sides;
+  u32 offset[FDS_MAXSIDES];
+  u32 cluster[FDS_MAXSIDES];
+} fdsindex_t;
+
+//turns a .fds image back into the bytes on the disk, gaps, start marks and
+//crcs included, as they are read
+typedef struct fdsreader_s {
+  struct fat_file_struct *fd;
+  fdspatch_t patch;
+
+  //gap bytes between blocks
+  u8 blockgap;
+
+  //image offset of the side being read
+  u32 start;
+
+  //what is being sent and how many bytes of it are left
+  u8 state;
+  u16 count;
+
+  //current block
+  u8 type;
+  u16 crc;
+
+  //file size from the last file header block
+  u16 filesize;
+
+  //image bytes read from the side, and a small buffer of them
+  u16 sidepos;
+  u8 in[32];
+  u8 inpos, inlen;
+
+  //bytes sent so far, and the last FDS_MARKS block starts
+  u32 stream;
+  fdsmark_t mark[FDS_MARKS];
+  u8 marks;
+} fdsreader_t;
+
+u8 fds_writer_open(fdswriter_t *w, struct fat_file_struct *fd, fdsblock_t *table, u8 pass);
+u8 fds_writer_data(fdswriter_t *w, const u8 *data, u16 len);
+u8 fds_writer_close(fdswriter_t *w);
+
+struct flashimage_s;
+
+u8 fds_index(fdsindex_t *x, struct fat_file_struct *fd);
+u8 fds_index_flash(fdsindex_t *x, const struct flashimage_s *img);
+u8 fds_read_side(const fdsindex_t *x, u8 side, u16 pos, u8 *data, u8 len);
+u8 fds_reader_open(fdsreader_t *r, const fdsindex_t *x, u8 side, u16 leadgap, u8 blockgap, fdspatch_t patch);
+u16 fds_reader_read(fdsreader_t *r, u8 *data, u16 len);
+const fdsmark_t *fds_reader_locate(fdsreader_t *r, u32 stream);
+
+#endif
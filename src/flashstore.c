@@ -0,0 +1,213 @@
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <string.h>
+#include "flashstore.h"
+#include "fds.h"
+#if FLASH_IMPORT
+#include <avr/boot.h>
+#include "../lib/sd-reader/fat.h"
+#endif
+
+/*
+Built in images.  flashimages.h is made by the makefile from FLASH_IMAGES,
+one FLASH_IMAGE(name, symbol) line per image, where symbol_start and
+symbol_end are the ends of the image as avr-objcopy linked it in.
+*/
+#if FLASH_BUILTIN
+#define FLASH_IMAGE(str, sym)  extern const u8 sym##_start[], sym##_end[];
+#include "flashimages.h"
+#undef FLASH_IMAGE
+
+enum {
+#define FLASH_IMAGE(str, sym)  builtin_##sym,
+#include "flashimages.h"
+#undef FLASH_IMAGE
+  FLASH_BUILTINS
+};
+#else
+#define FLASH_BUILTINS  0
+#endif
+
+//the store area starts with its list of images, the images follow
+#define FLASH_STORE_DATA    (FLASH_STORE_START + SPM_PAGESIZE)
+
+//copy len bytes of flash from addr, carrying on from one 64k bank into the
+//next.  elpm z+ increments rampz:z as one 24 bit pointer.
+void flashstore_read(u32 addr, u8 *data, u16 len)
+{
+  if(len == 0)
+    return;
+#ifdef __AVR__
+  {
+    u8 rampz = RAMPZ;
+    u16 z = (u16)addr;
+
+    RAMPZ = (u8)(addr >> 16);
+    asm volatile(
+      "1: elpm __tmp_reg__, Z+   \n\t"
+      "   st X+, __tmp_reg__     \n\t"
+      "   sbiw %[len], 1         \n\t"
+      "   brne 1b                \n\t"
+      : "+z" (z), "+x" (data), [len] "+w" (len)
+      :
+      : "memory");
+    RAMPZ = rampz;
+  }
+#else
+  while(len--)
+    *data++ = pgm_read_byte_far(addr++);
+#endif
+}
+
+#if FLASH_IMPORT
+//entry n of the store list, 0 past the last one (erased flash)
+static u8 stored(u8 n, flashimage_t *img)
+{
+  if(n >= FLASH_STORE_MAX)
+    return(0);
+  flashstore_read(FLASH_STORE_START + n * sizeof(flashimage_t), (u8*)img, sizeof(flashimage_t));
+  return((u8)img->name[0] != 0xFF);
+}
+
+static u8 storecount(void)
+{
+  flashimage_t img;
+  u8 n = 0;
+
+  while(stored(n, &img))
+    n++;
+  return(n);
+}
+#endif
+
+#if FLASH_BUILTIN
+//built in images are linked in as they are, with the .fds header if they
+//have one
+static void skipheader(flashimage_t *img)
+{
+  char ident[4];
+
+  flashstore_read(img->addr, (u8*)ident, sizeof(ident));
+  if(img->size > FDS_HEADERSIZE && memcmp(ident, "FDS\x1A", 4) == 0) {
+    img->addr += FDS_HEADERSIZE;
+    img->size -= FDS_HEADERSIZE;
+  }
+}
+#endif
+
+//number of images, built in ones first
+u8 flashstore_count(void)
+{
+#if FLASH_IMPORT
+  return(FLASH_BUILTINS + storecount());
+#else
+  return(FLASH_BUILTINS);
+#endif
+}
+
+//image n, returns 0 if there is no such image
+u8 flashstore_get(u8 n, flashimage_t *img)
+{
+#if FLASH_BUILTIN
+  u8 i = 0;
+
+#define FLASH_IMAGE(str, sym)                                   \
+  if(i++ == n) {                                                \
+    img->addr = pgm_get_far_address(sym##_start);               \
+    img->size = pgm_get_far_address(sym##_end) - img->addr;     \
+    strncpy(img->name, str, sizeof(img->name) - 1);             \
+    img->name[sizeof(img->name) - 1] = 0;                       \
+    skipheader(img);                                            \
+    return(1);                                                  \
+  }
+#include "flashimages.h"
+#undef FLASH_IMAGE
+#endif
+
+#if FLASH_IMPORT
+  return(stored(n - FLASH_BUILTINS, img));
+#else
+  return(0);
+#endif
+}
+
+#if FLASH_IMPORT
+
+//erase and program one page, run from the boot section as spm has to be,
+//so it must never be inlined
+BOOTLOADER_SECTION __attribute__((noinline)) void flashstore_writepage(u32 addr, const u8 *data)
+{
+  u8 sreg = SREG;
+  u16 i;
+
+  cli();
+  boot_page_erase(addr);
+  boot_spm_busy_wait();
+  for(i = 0; i < SPM_PAGESIZE; i += 2)
+    boot_page_fill(addr + i, data[i] | ((u16)data[i + 1] << 8));
+  boot_page_write(addr);
+  boot_spm_busy_wait();
+  boot_rww_enable();
+  SREG = sreg;
+}
+
+//empty the store area, only the list is erased
+void flashstore_clear(void)
+{
+  u8 page[SPM_PAGESIZE];
+
+  memset(page, 0xFF, sizeof(page));
+  flashstore_writepage(FLASH_STORE_START, page);
+}
+
+/*
+Copy a .fds image from the sd card into the store area, after the images
+already there, as many of its sides as fit.  Returns 0 if none do or the
+list is full.
+*/
+u8 flashstore_import(struct fat_file_struct *fd, const char *name)
+{
+  u8 page[SPM_PAGESIZE];
+  fdsindex_t x;
+  flashimage_t img;
+  u32 addr = FLASH_STORE_DATA, left;
+  u8 n = storecount(), sides;
+
+  if(n >= FLASH_STORE_MAX || fds_index(&x, fd) == 0)
+    return(0);
+
+  //after the last image, on a page boundary
+  if(n && stored(n - 1, &img))
+    addr = (img.addr + img.size + SPM_PAGESIZE - 1) & ~(u32)(SPM_PAGESIZE - 1);
+  for(sides = 0; sides < x.sides; sides++) {
+    if(addr + (u32)(sides + 1) * FDS_SIDESIZE > FLASH_STORE_END)
+      break;
+  }
+  if(sides == 0 || fat_seek_file_cluster(fd, x.offset[0], x.cluster[0]) == 0)
+    return(0);
+
+  //the sides follow each other in the file as they will in flash
+  memset(&img, 0, sizeof(img));
+  strncpy(img.name, name, sizeof(img.name) - 1);
+  img.addr = addr;
+  img.size = (u32)sides * FDS_SIDESIZE;
+  for(left = img.size; left; ) {
+    u16 len = (left > SPM_PAGESIZE) ? SPM_PAGESIZE : left;
+
+    memset(page, 0xFF, sizeof(page));
+    if(fat_read_file(fd, page, len) != len)
+      return(0);
+    flashstore_writepage(addr, page);
+    addr += SPM_PAGESIZE;
+    left -= len;
+  }
+
+  //list it last, so a failed import leaves nothing behind
+  flashstore_read(FLASH_STORE_START, page, sizeof(page));
+  memcpy(&page[n * sizeof(flashimage_t)], &img, sizeof(img));
+  flashstore_writepage(FLASH_STORE_START, page);
+  return(1);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __flashstore_h__
+#define __flashstore_h__
+
+#include "types.h"
+
+/*
+Disk images kept in flash, played back without touching the sd card.  All
+addresses are 24 bit flash byte addresses, read with elpm, so images can be
+anywhere in the 128k.
+
+Built in images are listed in FLASH_IMAGES in the makefile and linked in as
+is.  With FLASH_IMPORT=1 images can also be copied from the sd card into the
+store area, FLASH_STORE_START up to FLASH_STORE_END, which starts with a page
+listing what is in it.  The Flash store menu imports the sd image being
+played and clears the store.  Importing programs flash with spm, which only
+works from the boot section, so it needs a bootloader that leaves room for
+flashstore_writepage there (the teensy halfkay bootloader does not).
+*/
+
+//set to 1 (in the makefile) to import images from the sd card
+#ifndef FLASH_IMPORT
+#define FLASH_IMPORT        0
+#endif
+
+//store area for imported images.  the program has to end below the start,
+//the end is where the bootloader starts.  the default holds one side.
+#ifndef FLASH_STORE_START
+#define FLASH_STORE_START   0xD000UL
+#endif
+#ifndef FLASH_STORE_END
+#define FLASH_STORE_END     0x1E000UL
+#endif
+
+//most images listed in the store area
+#define FLASH_STORE_MAX     10
+
+typedef struct flashimage_s {
+  char name[16];
+  u32 addr;             //first side, without the .fds header
+  u32 size;             //a whole number of sides
+} __attribute__((packed)) flashimage_t;
+
+void flashstore_read(u32 addr, u8 *data, u16 len);
+u8 flashstore_count(void);
+u8 flashstore_get(u8 n, flashimage_t *img);
+
+#if FLASH_IMPORT
+struct fat_file_struct;
+
+void flashstore_clear(void);
+u8 flashstore_import(struct fat_file_struct *fd, const char *name);
+#endif
+
+#endif
@@ -12,6 +12,12 @@
 #include "SystemFont5x7.h"
 #include "util.h"
 #include "menu.h"
+#include "diskdrive.h"
+#include "fds.h"
+#include "merge.h"
+#include "catalog.h"
+#include "profile.h"
+#include "sdbench.h"
 #include "../lib/sd-reader/fat.h"
 #include "../lib/sd-reader/fat_config.h"
 #include "../lib/sd-reader/partition.h"
@@ -29,184 +35,12 @@
 #define CPU_125kHz      0x07
 #define CPU_62kHz       0x08
 
-#define is_mediaset()   ((PINF & 0x02) == 0)
-#define is_motoron()    ((PINF & 0x04) != 0)
-#define is_ready()      ((PINF & 0x08) == 0)
-#define is_writable()   ((PINF & 0x10) == 0)
-
 struct partition_struct *partition;
 struct fat_fs_struct *fs;
 struct fat_dir_entry_struct directory;
 struct fat_dir_struct *dd;
 struct fat_file_struct *fd;
 
-volatile u8 changed = 0;
-volatile u8 ingap = 1;
-
-volatile u8 rise = 0;
-
-volatile u8 timeunits = 0;
-
-//volatile u8 timercounts[2048];
-//volatile u16 numcounts = 0;
-
-#define SKIP_GAP_BITS   14000
-
-volatile u8 buffer[2][256];
-volatile u8 bufferpos;
-volatile u8 curbuffer;
-volatile u8 bufbyte;
-volatile u8 curbit;
-volatile u8 writebuffer;
-
-volatile long skip = SKIP_GAP_BITS;
-volatile long bits = 0;
-volatile long outgap = 0;
-
-volatile u8 started = 0;
-
-//initialize the buffers that recieve data from the disk drive
-void buffer_init()
-{
-  //for storing the data read off the disk
-  bufferpos = 0;
-  curbuffer = 0;
-  bufbyte = 0;
-  curbit = 0;
-  writebuffer = 0;
-}
-
-static u8 lasttime = 0;
-
-//external interrupt tied to change of signal connected to d0 (reset, active low)
-ISR(INT0_vect)
-{
-  //if disk drive is ready, start outputting data
-  if(is_ready()) {
-    EIMSK |= (1 << INT4);     //enable INT4
-    TCNT0 = 0;
-  }
-
-  //disk drive no longer ready, transfer complete
-  else {
-    EIMSK &= ~(1 << INT4);    //disable INT4
-    started = 0;
-  }
-}
-
-//external interrupt tied to rise of signal connected to e4 (read data)
-ISR(INT4_vect)
-{
-  static u8 lasttime = 0;
-  u8 time = TCNT0;
-  u8 bit = 0;
-
-  TCNT0 = 0;
-
-  if(time >= 0x21)
-    bit = 1;
-
-  //skip the first 14000 bits read
-  if(skip) {
-    skip--;
-    bits++;
-    return;
-  }
-
-  //if this is a gap period, wait for block start mark
-  if(ingap) {
-
-    //if this is a 1 then block is starting
-    if(bit) {
-      outgap = bits;
-      ingap = 0;
-    }
-  }
-
-  //not in gap, we are receiving data
-  else {
-    bufbyte = (bufbyte << 1) | bit;
-    curbit++;
-
-    //if this is the eighth bit, put byte into buffer
-    if(curbit == 8) {
-      buffer[curbuffer][bufferpos] = bufbyte;
-      bufferpos++;
-
-      //if this buffer is full, set writebuffer flag and change buffers
-      if(bufferpos == 0) {
-        writebuffer = curbuffer + 1;
-        curbuffer ^= 1;
-      }
-    }
-   
-  }
-
-/*  if(numcounts < 2048) {
-    timercounts[numcounts] = time;
-    numcounts++;
-  }*/
-  bits++;
-}
-
-//timer interrupt for disk drive data counter
-//20.75 time units per 1/96400 hz
-//16mhz / 8 / 96.4khz = 20.746887966804979253112033195021
-/*ISR(TIMER2_COMPA_vect)
-{
-  timeunits++;
-}*/
-
-void timeunit_init(void)
-{
-  //initialize time unit (for receiving data from the disk drive)
-  TCCR0A = 0x00;      //disable unused features
-  TCCR0B = 0x02;      //div by 8 prescaler
-  TIMSK0 = 0x00;      //disable interrupts
-}
-
-void diskdrive_init(void)
-{
-/*
-pin config:
-
-stop motor    = f0 (input)  (active low)
-media set     = f1 (output) (active low)
-batt/motor on = f2 (output)
-ready         = f3 (output) (active low)
-read data     = f4 (output)
-rw media      = f5 (output) (active low)
-write         = f6 (input)
-scan media    = f7 (input)  (active low)
-write data    = d5 (input)  (active low)
-*/
-
-  //set port input/outputs
-  DDRF = 0xC1;
-  DDRD |= 0x20;
-
-  //enable pullups
-  PORTF = 0x3E;
-
-  //default values
-  PORTD = 0x20;
-  PORTF = 0x80;
-
-  //e4 as input (irq for read data)
-  DDRE &= ~0x10;
-  PORTE |= 0x10;
-
-  //d0 as input (irq for ready change)
-  DDRD &= ~0x01;
-  PORTD |= 0x01;
-
-  //external interrupts
-  EIMSK = 0x00;     //disable all external interrupts
-  EICRA = 0x01;     //set INT0 to trigger with level change
-  EICRB = 0x03;     //set INT4 to trigger with 0->1
-  EIMSK = 0x01;     //enable INT0, disable INT4
-}
-
 void init(void)
 {
   //led output
@@ -215,16 +49,14 @@ void init(void)
   //power reduction register
   PRR0 = 0;
 
-  //initialize subsystems
-  diskdrive_init();
+  //initialize subsystems, the ram adapter has the connector until the dump
+  //screen is chosen
   ks0108_init(0);
   ks0108_clearscreen(0);
   ks0108_selectfont(System5x7,0);
   ks0108_gotoxy(0,0);
   usb_init();
-//  ramadapter_init();
-//  diskdrive_init();
-  timeunit_init();
+  ramadapter_init();
   nespad_init();
   menu_init();
 
@@ -265,37 +97,293 @@ void init(void)
     return;
   }
 
+  //check the game catalog, rescanning the card if it has changed
+  ks0108_gotoxy(0,48);
+  ks0108_puts("images ");
+  ks0108_printnumber(catalog_init(fs,dd));
+
+  //and the load timing profiles
+  profile_init(fs,dd);
+  sdbench_init(fs,dd);
+
   ks0108_gotoxy(0,56);
   ks0108_puts("sd card init ok");
   _delay_ms(500);
 }
 
-uint8_t find_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name, struct fat_dir_entry_struct* dir_entry)
+//create (or truncate) a file for writing and open it
+struct fat_file_struct* create_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name)
 {
-    while(fat_read_dir(dd, dir_entry))
-    {
-        if(strcmp(dir_entry->long_name, name) == 0)
-        {
-            fat_reset_dir(dd);
-            return 1;
-        }
+    struct fat_dir_entry_struct file_entry;
+    struct fat_file_struct* fd;
+
+    if(!fat_create_file(dd, name, &file_entry))
+        return 0;
+
+    if((fd = fat_open_file(fs, &file_entry)) == 0)
+        return 0;
+
+    if(!fat_resize_file(fd, 0)) {
+        fat_close_file(fd);
+        return 0;
     }
 
-    return 0;
+    return fd;
+}
+
+//set while a dump is being written to fd
+static u8 dumping = 0;
+
+//flux dumps rewrite the header with the ring counts at the end
+static fluxhdr_t fluxhdr;
+
+//fds dumps go through the image writer
+static u8 dumpmode;
+static fdswriter_t fdswriter;
+
+//multi pass fds dumps, every pass is kept open until they are merged
+static u8 passes, pass;
+static struct fat_file_struct *passfd[DUMP_PASSES];
+static fdsblock_t *blocktable;
+static u8 numblocks;
+
+//flux and bit dumps are allocated up front and written with one multiple
+//block write, so the card erases ahead of them and is not waited on after
+//every block.  the file is cut down to what was written at the end.
+#define DUMP_PREALLOC_FLUX  0x100000UL
+#define DUMP_PREALLOC_BITS  0x20000UL
+
+//write decoded data to the dump file
+static u8 dump_data(const u8 *data, u16 len)
+{
+  if(dumpmode == DUMP_FDS)
+    return(fds_writer_data(&fdswriter,data,len));
+  return(fat_write_file(fd,data,len) == len);
 }
 
-struct fat_file_struct* open_file_in_dir(struct fat_fs_struct* fs, struct fat_dir_struct* dd, const char* name)
+//start a multiple block write from the dump position on, as far as the
+//clusters of the file follow each other
+static void dump_session(void)
 {
-    struct fat_dir_entry_struct file_entry;
-    if(!find_file_in_dir(fs, dd, name, &file_entry))
-        return 0;
+  offset_t offset;
+  u32 length;
+
+  if(fat_get_file_extent(fd,&offset,&length) && length)
+    sd_raw_write_open(offset,((offset & 511) + length + 511) / 512);
+}
+
+//end the multiple block write and cut the file down to what was written
+static void dump_trim(void)
+{
+  int32_t pos = 0;
+
+  if(dumpmode == DUMP_FDS)
+    return;
+  sd_raw_sync();
+  if(fat_seek_file(fd,&pos,FAT_SEEK_CUR))
+    fat_resize_file(fd,pos);
+}
 
-    return fat_open_file(fs, &file_entry);
+//close every file the dump has open
+static void dump_close(void)
+{
+  u8 i;
+
+  for(i = 0; i < pass; i++)
+    fat_close_file(passfd[i]);
+  if(dumping) {
+    dump_trim();
+    fat_close_file(fd);
+  }
+  pass = 0;
+  dumping = 0;
+}
+
+//create the output file for the current pass
+static u8 dump_open(u8 mode)
+{
+  char passname[] = "pass1.fds";
+  const char *name;
+
+  switch(mode) {
+    case DUMP_FLUX: name = "output.flx";  break;
+    case DUMP_FDS:  name = "output.fds";  break;
+    default:        name = "output.bin";  break;
+  }
+  if(passes > 1) {
+    passname[4] = '1' + pass;
+    name = passname;
+  }
+
+  ks0108_gotoxy(0,48);
+  if((fd = create_file_in_dir(fs,dd,name)) == 0) {
+    ks0108_puts("error creating file");
+    return(0);
+  }
+
+  //flux dumps start with a header describing the capture
+  if(mode == DUMP_FLUX) {
+    diskdrive_fluxheader(&fluxhdr);
+    if(fat_write_file(fd,(uint8_t*)&fluxhdr,sizeof(fluxhdr)) != sizeof(fluxhdr)) {
+      ks0108_puts("error writing header");
+      fat_close_file(fd);
+      return(0);
+    }
+  }
+
+  //fds images start with the .fds header
+  if(mode == DUMP_FDS && fds_writer_open(&fdswriter,fd,blocktable,pass) == 0) {
+    ks0108_puts("error writing header");
+    fat_close_file(fd);
+    return(0);
+  }
+
+  //without room for the preallocation the dump is written as it grows
+  if(mode != DUMP_FDS && fat_resize_file(fd,mode == DUMP_FLUX ? DUMP_PREALLOC_FLUX : DUMP_PREALLOC_BITS))
+    dump_session();
+
+  return(1);
+}
+
+//open the output file and start reading the disk, fds dumps can read the
+//disk more than once and merge the passes
+static void dump_start(u8 mode, u8 npasses)
+{
+  if(dumping)
+    return;
+
+  //the block table lives in the play ring while the drive has the
+  //connector, without room for it only one pass is read
+  blocktable = ramadapter_borrow(sizeof(fdsblock_t) * FDS_MAXBLOCKS);
+  if(blocktable)
+    memset(blocktable,0,sizeof(fdsblock_t) * FDS_MAXBLOCKS);
+  else
+    npasses = 1;
+
+  passes = npasses;
+  pass = 0;
+  numblocks = 0;
+
+  if(dump_open(mode) == 0)
+    return;
+
+  dumpmode = mode;
+  dumping = 1;
+  diskdrive_start(mode);
+}
+
+//write out the full capture slots
+static void dump_write(void)
+{
+  volatile u8 *slot;
+
+  while((slot = ring_full(&decoder.ring)) != 0) {
+
+    //leave the slots in the ring while the card programs the last block,
+    //and start the multiple block write again where one ended
+    if(dumpmode != DUMP_FDS) {
+      if(sd_raw_write_busy())
+        break;
+      if(sd_raw_write_active() == 0)
+        dump_session();
+    }
+    if(dump_data((u8*)slot,256) == 0) {
+      ks0108_gotoxy(0,48);
+      ks0108_puts("error writing dump");
+    }
+    ring_release(&decoder.ring);
+  }
+}
+
+//put the capture ring counts into the flux header
+static void dump_fluxheader(void)
+{
+  int32_t offset = 0;
+
+  fluxhdr.overruns = decoder.ring.overruns;
+  fluxhdr.highwater = decoder.ring.highwater;
+  if(fat_seek_file(fd,&offset,FAT_SEEK_SET))
+    fat_write_file(fd,(uint8_t*)&fluxhdr,sizeof(fluxhdr));
+}
+
+//all passes are read, merge them into output.fds and write the report
+static void dump_merge(void)
+{
+  struct fat_file_struct *out;
+  u8 ok = 0;
+
+  ks0108_gotoxy(0,48);
+  ks0108_puts("merging...");
+  if((out = create_file_in_dir(fs,dd,"output.fds")) != 0) {
+    ok = merge_passes(passfd,passes,out,blocktable,numblocks);
+    fat_close_file(out);
+  }
+  dump_close();
+
+  if(ok && (out = create_file_in_dir(fs,dd,"report.txt")) != 0) {
+    merge_report(out,blocktable,numblocks,passes);
+    fat_close_file(out);
+  }
+  sd_raw_sync();
+
+  ks0108_gotoxy(0,48);
+  ks0108_puts(ok ? "merge complete" : "error merging");
+}
+
+//drive is no longer ready, write what is left and close the file
+static void dump_finish(void)
+{
+  volatile u8 *tail;
+  u8 len;
+
+  tail = decoder_finish(&decoder,&len);
+  while(ring_full(&decoder.ring))
+    dump_write();
+  if(len)
+    dump_data((u8*)tail,len);
+  dump_trim();
+  if(dumpmode == DUMP_FLUX)
+    dump_fluxheader();
+  if(dumpmode == DUMP_FDS) {
+    fds_writer_close(&fdswriter);
+    if(fdswriter.slots > numblocks)
+      numblocks = fdswriter.slots;
+  }
+
+  //keep the motor running for the next pass
+  if(passes > 1) {
+    passfd[pass++] = fd;
+    if(pass < passes) {
+      if(dump_open(dumpmode) == 0) {
+        diskdrive_stop();
+        dumping = 0;
+        dump_close();
+        return;
+      }
+      diskdrive_next(dumpmode);
+      ks0108_gotoxy(0,48);
+      ks0108_puts("pass ");
+      ks0108_printnumber(pass + 1);
+      return;
+    }
+    diskdrive_stop();
+    dumping = 0;
+    dump_merge();
+    return;
+  }
+
+  diskdrive_stop();
+  fat_close_file(fd);
+  sd_raw_sync();
+  dumping = 0;
+
+  ks0108_gotoxy(0,48);
+  ks0108_puts("dump complete");
 }
 
 int main(void)
 {
-  struct fat_dir_entry_struct file_entry;
+  u8 pressed, lastpad = 0, drive = 0;
 
   //initialize clock speed and interrupts
   CPU_PRESCALE(CPU_16MHz);
@@ -312,33 +400,50 @@ int main(void)
   //enable interrupts
   sei();
 
-  PORTD |= 0x20;
-  PORTF |= 0x40;
-
-  PORTF &= ~0x01;
-  PORTF |= 0x80;
-
   PORTD &= ~(1 << 6);
 
-  ks0108_gotoxy(0,40);
-  ks0108_puts("opening output.bin");
-  ks0108_gotoxy(0,48);
-  if(fat_create_file(dd,"output.bin",&file_entry)) {
-    int32_t offset = 0;
-
-    fd = open_file_in_dir(fs,dd,"output.bin");
-    if(!fat_seek_file(fd,&offset,FAT_SEEK_SET)) {
-      ks0108_puts("error seeking");
-      fat_close_file(fd);
-    }
-  }
-
   //the main loop
   for(;;) {
 
     //toggle the led
     PORTD ^= (1 << 6);
 
+    //needs to be polled 60 times a second, buttons act when pressed, not
+    //while held, so the one that left the menu does not start a dump
+    nespad_poll();
+    pressed = paddata & ~lastpad;
+    lastpad = paddata;
+
+    //emulating, the menu runs until start or dump leaves it
+    if(menu_dumping() == 0) {
+      if(drive) {
+        diskdrive_release();
+        ramadapter_init();
+        drive = 0;
+      }
+
+      //nothing else while data is sent or received
+      if(ramadapter_tick())
+        continue;
+      if(menu_active())
+        menu_tick();
+      else if(pressed & BTN_START) {
+        ks0108_clearscreen(0);
+        menu_init();
+      }
+      continue;
+    }
+
+    //dump screen, the drive takes the connector
+    if(drive == 0) {
+      ramadapter_release();
+      diskdrive_init();
+      PORTE |= 0x20;
+      PORTF |= 0x40;
+      diskdrive_stop();
+      drive = 1;
+    }
+
     ks0108_gotoxy(0,8);
     if(is_motoron())
       ks0108_puts("motoron 1");
@@ -352,71 +457,65 @@ int main(void)
       ks0108_puts("ready 0");
 
     ks0108_gotoxy(64,16);
-    ks0108_printnumber(bits);
+    ks0108_printnumber(decoder_bits(&decoder));
 
     ks0108_gotoxy(64,24);
-    ks0108_printnumber(outgap);
-
-    if(writebuffer) {
-      if(fat_write_file(fd,(uint8_t*)buffer[writebuffer - 1],256) != 256) {
-        ks0108_gotoxy(0,48);
-        ks0108_puts("error writing output.bin");
-      }
-      writebuffer = 0;
+    ks0108_printnumber(decoder.outgap);
+
+    //recovered bit rate and the threshold it gives
+    ks0108_gotoxy(0,40);
+    ks0108_puts("rate ");
+    ks0108_printnumber(TIMER_CLOCK * 16 / decoder.cell);
+    ks0108_gotoxy(84,40);
+    ks0108_puts("th ");
+    ks0108_printnumber(decoder.threshold);
+
+    //blocks read and crc errors for fds dumps
+    if(dumpmode == DUMP_FDS) {
+      ks0108_gotoxy(0,32);
+      ks0108_puts("blocks ");
+      ks0108_printnumber(decoder.blocks);
+      ks0108_gotoxy(64,32);
+      ks0108_puts("crc err ");
+      ks0108_printnumber(fdswriter.crcerrors);
     }
-    //needs to be polled 60 times a second
-    nespad_poll();
 
-    //check for jumping to the bootloader
-    if(paddata & BTN_START) {
-      PORTF &= ~0x01;
-      PORTF |= 0x80;
-      fat_close_file(fd);
-      sd_raw_sync();
-      bootloader();
+    //capture ring state, overruns mean lost data
+    ks0108_gotoxy(0,56);
+    ks0108_puts("ring ");
+    ks0108_printnumber(decoder.ring.highwater);
+    ks0108_puts("/");
+    ks0108_printnumber(RING_SLOTS - 1);
+    ks0108_gotoxy(64,56);
+    ks0108_puts("ovr ");
+    ks0108_printnumber(decoder.ring.overruns);
+
+    if(dumping) {
+      if(ring_used(&decoder.ring))
+        dump_write();
+      else if(started == 0)
+        dump_finish();
     }
 
-    //start transfer
-    if((paddata & BTN_A) && is_mediaset()) {
-      PORTF &= ~0x01;
-      PORTF |= 0x80;
-      _delay_ms(50);
-      PORTF |= 0x01;
-      PORTF &= ~0x80;
-      skip = SKIP_GAP_BITS;
-      started = 1;
+    //back to the menu, the bootloader is in there
+    if(pressed & BTN_START) {
+      diskdrive_stop();
+      dump_close();
+      sd_raw_sync();
+      ks0108_clearscreen(0);
+      menu_init();
+      continue;
     }
 
-/*    if(numcounts == 2048) {
-      static u8 wrote = 0;
-
-      if(wrote == 0) {
-        struct fat_dir_entry_struct file_entry;
-
-        ks0108_gotoxy(0,40);
-        ks0108_puts("writing output.bin");
-        ks0108_gotoxy(0,48);
-        if(fat_create_file(dd,"output.bin",&file_entry)) {
-          int32_t offset = 0;
-
-          fd = open_file_in_dir(fs,dd,"output.bin");
-          if(!fat_seek_file(fd, &offset, FAT_SEEK_SET)) {
-            ks0108_puts("error seeking");
-          }
-          else if(fat_write_file(fd,(uint8_t*)timercounts,2048) != 2048) {
-            ks0108_puts("error writing");
-          }
-          else if(!sd_raw_sync())
-            ks0108_puts("error syncing disk");
-          else
-            ks0108_puts("writing is ok");
-          fat_close_file(fd);
-        }
-        else {
-          ks0108_puts("error creating file");
-        }
-        wrote = 1;
-      }
-    }*/
+    //start transfer, a for an fds image, up for a multi pass fds image,
+    //b for a flux dump and select for a bit dump
+    if((pressed & BTN_A) && is_mediaset())
+      dump_start(DUMP_FDS,1);
+    if((pressed & BTN_UP) && is_mediaset())
+      dump_start(DUMP_FDS,DUMP_PASSES);
+    if((pressed & BTN_B) && is_mediaset())
+      dump_start(DUMP_FLUX,1);
+    if((pressed & BTN_SELECT) && is_mediaset())
+      dump_start(DUMP_BITS,1);
   }
 }
@@ -7,6 +7,11 @@
 #include "ks0108.h"
 #include "nespad.h"
 #include "ramadapter.h"
+#include "writeback.h"
+#include "flashstore.h"
+#include "catalog.h"
+#include "profile.h"
+#include "sdbench.h"
 
 static int selection;
 
@@ -22,6 +27,10 @@ typedef struct menu_s {
 
 menu_t *curmenu = 0;
 
+//set when the menu was left for the dump screen, the connector is the
+//drive's until the menu comes back
+static u8 dumpscreen = 0;
+
 static void entermenu(menu_t *menu)
 {
   ks0108_clearscreen(0);
@@ -29,8 +38,23 @@ static void entermenu(menu_t *menu)
   curmenu = menu;
 }
 
+static char statename[][9] = {
+  "idle    ", "spinup  ", "ready   ", "transfer", "stopping",
+};
+
 static void tick_debugmenu(void)
 {
+  ks0108_gotoxy(0,8);
+  ks0108_puts("state ");
+  ks0108_puts(statename[ramadapter_state()]);
+
+  //blocks written, and writes that did not fit in the writeback pages
+  ks0108_gotoxy(0,16);
+  ks0108_puts("wrote ");
+  ks0108_printnumber(writeback_blocks());
+  ks0108_puts(" fail ");
+  ks0108_printnumber(ramadapter_writefails());
+  ks0108_puts("  ");
 
   ks0108_gotoxy(0,8 + 24);
   ks0108_puts("scanmedi");
@@ -73,6 +97,19 @@ static void tick_debugmenu(void)
 
   ks0108_gotoxy(63 + 10 * 6 - 2,32 + 24);
   ks0108_putchar(rastate.rwmedia == 0 ? '0' : '1');
+
+  ks0108_gotoxy(0,24);
+  ks0108_puts("rate ");
+  ks0108_printnumber(ramadapter_ratehz());
+  ks0108_puts("hz ");
+  ks0108_printnumber(ramadapter_rate());
+  ks0108_puts("%  ");
+
+  ks0108_gotoxy(0,32 + 24);
+  ks0108_puts("side ");
+  ks0108_putchar('1' + ramadapter_curside());
+  ks0108_putchar('/');
+  ks0108_putchar('0' + ramadapter_sides());
 }
 
 static void handle_backtomain(void)
@@ -86,22 +123,213 @@ menu_t debugmenu[] = {
   {T_END,   "",             0},
 };
 
+//image from the card being played, and its number in the catalog
+static struct fat_file_struct *sdimage = 0;
+static u16 sdimagenum = 0xFFFF;
+
+static void tick_optionsmenu(void)
+{
+  ks0108_gotoxy(0,56);
+  ks0108_puts(profile_turbo() ? "turbo on " : "turbo off");
+  ks0108_gotoxy(72,56);
+  ks0108_puts("img ");
+  if(sdimage)
+    ks0108_printnumber(sdimagenum + 1);
+  else
+    ks0108_puts("-");
+  ks0108_puts("  ");
+}
+
+//switch turbo timing on or off, the next image chosen gets it
+static void handle_turbo(void)
+{
+  profile_setturbo(profile_turbo() == 0);
+}
+
+static void handle_image(void);
+static void handle_flash(void);
+static void handle_bench(void);
+#if FLASH_IMPORT
+static void handle_flashstore(void);
+#endif
+
+menu_t optionsmenu[] = {
+  {T_TITLE, "Options",      tick_optionsmenu},
+  {T_ITEM,  "Turbo",        handle_turbo},
+  {T_ITEM,  "SD image",     handle_image},
+#if FLASH_IMPORT
+  {T_ITEM,  "Flash store",  handle_flashstore},
+#else
+  {T_ITEM,  "Flash image",  handle_flash},
+#endif
+  {T_ITEM,  "SD bench",     handle_bench},
+  {T_ITEM,  "Back to main", handle_backtomain},
+  {T_END,   "",             0},
+};
+
+//last benchmark results, in bytes per second
+static sdbench_t bench;
+static u8 benchstate;     //0 not run, 1 done, 2 failed
+
+static void tick_benchmenu(void)
+{
+  u8 i;
+
+  ks0108_gotoxy(0,56);
+  ks0108_puts(benchstate == 2 ? "bench failed    " : "bytes per second");
+  if(benchstate != 1)
+    return;
+  ks0108_gotoxy(36,32);
+  ks0108_puts("byte");
+  ks0108_gotoxy(84,32);
+  ks0108_puts("block");
+  for(i = 0; i < 2; i++) {
+    ks0108_gotoxy(0,40 + i * 8);
+    ks0108_puts(i ? "write" : "read");
+    ks0108_gotoxy(36,40 + i * 8);
+    ks0108_printnumber(i ? bench.write[0] : bench.read[0]);
+    ks0108_puts(" ");
+    ks0108_gotoxy(84,40 + i * 8);
+    ks0108_printnumber(i ? bench.write[1] : bench.read[1]);
+    ks0108_puts(" ");
+  }
+}
+
+//time sd card transfers byte by byte and with the block loops
+static void handle_runbench(void)
+{
+  ks0108_gotoxy(0,56);
+  ks0108_puts("running...      ");
+  benchstate = sdbench_run(&bench) ? 1 : 2;
+}
+
+menu_t benchmenu[] = {
+  {T_TITLE, "SD Bench",     tick_benchmenu},
+  {T_ITEM,  "Run",          handle_runbench},
+  {T_ITEM,  "Back to main", handle_backtomain},
+  {T_END,   "",             0},
+};
+
+//leave the menu while the image plays, start goes back to it
 static void handle_start(void)
 {
-  ks0108_clearscreen(0);
+  entermenu(0);
   ks0108_gotoxy(0,0);
   ks0108_puts("Running...");
-  entermenu(0);
 }
 
+//put the next side of the image in, back to the first after the last
+static void handle_side(void)
+{
+  u8 next = ramadapter_curside() + 1;
+
+  ramadapter_side(next < ramadapter_sides() ? next : 0);
+}
+
+//play the next image in the card's catalog, back to the first after the
+//last.  it is opened straight from its catalog entry, the last one is closed
+//once the ram adapter has let go of it.
+static void handle_image(void)
+{
+  struct fat_file_struct *next;
+  u16 count = catalog_count();
+
+  if(count == 0)
+    return;
+  sdimagenum = (sdimagenum + 1 < count) ? sdimagenum + 1 : 0;
+  if((next = catalog_open(sdimagenum)) == 0)
+    return;
+  ramadapter_image(next);
+  if(sdimage)
+    fat_close_file(sdimage);
+  sdimage = next;
+}
+
+//play the next image kept in flash, back to the first after the last
+static void handle_flash(void)
+{
+  static u8 cur = 0xFF;
+  u8 count = flashstore_count();
+
+  if(count == 0)
+    return;
+  cur = (cur + 1 < count) ? cur + 1 : 0;
+  ramadapter_flashimage(cur);
+  if(sdimage)
+    fat_close_file(sdimage);
+  sdimage = 0;
+}
+
+#if FLASH_IMPORT
+static u8 importstate;    //0 nothing done, 1 done, 2 failed
+
+static void tick_flashmenu(void)
+{
+  ks0108_gotoxy(0,56);
+  ks0108_puts("images ");
+  ks0108_printnumber(flashstore_count());
+  ks0108_puts(importstate == 0 ? "       " : importstate == 1 ? " done  " : " failed");
+}
+
+//copy the sd image being played into the store.  it is opened again for
+//this, the ram adapter goes on reading the one it has.
+static void handle_import(void)
+{
+  struct fat_file_struct *fd;
+  catentry_t e;
+
+  importstate = 2;
+  if(sdimage == 0 || catalog_get(sdimagenum,&e) == 0)
+    return;
+  if((fd = catalog_open(sdimagenum)) == 0)
+    return;
+  ks0108_gotoxy(0,56);
+  ks0108_puts("importing...    ");
+  if(flashstore_import(fd,e.name))
+    importstate = 1;
+  fat_close_file(fd);
+}
+
+//empty the store, a flash image being played may be in it so it is stopped
+static void handle_clear(void)
+{
+  if(sdimage == 0)
+    ramadapter_image(0);
+  flashstore_clear();
+  importstate = 1;
+}
+
+menu_t flashmenu[] = {
+  {T_TITLE, "Flash Store",  tick_flashmenu},
+  {T_ITEM,  "Flash image",  handle_flash},
+  {T_ITEM,  "Import SD img", handle_import},
+  {T_ITEM,  "Clear store",  handle_clear},
+  {T_ITEM,  "Back to main", handle_backtomain},
+  {T_END,   "",             0},
+};
+
+static void handle_flashstore(void)
+{
+  importstate = 0;
+  entermenu((menu_t*)&flashmenu);
+}
+#endif
+
 static void handle_options(void)
 {
-  
+  entermenu((menu_t*)&optionsmenu);
 }
 
+static void handle_bench(void)
+{
+  entermenu((menu_t*)&benchmenu);
+}
+
+//leave the menu for the dump screen, start goes back to it
 static void handle_dump(void)
 {
-  
+  entermenu(0);
+  dumpscreen = 1;
 }
 
 static void handle_debug(void)
@@ -117,6 +345,7 @@ static void handle_bootloader(void)
 menu_t rootmenu[] = {
   {T_TITLE, "Main Menu",  0},
   {T_ITEM,  "Start",      handle_start},
+  {T_ITEM,  "Flip side",  handle_side},
   {T_ITEM,  "Options",    handle_options},
   {T_ITEM,  "Dump",       handle_dump},
   {T_ITEM,  "Debug",      handle_debug},
@@ -128,6 +357,19 @@ void menu_init(void)
 {
   selection = 0;
   curmenu = (menu_t*)&rootmenu;
+  dumpscreen = 0;
+}
+
+//set while a menu is shown, the main loop runs it instead of the dump screen
+u8 menu_active(void)
+{
+  return(curmenu != 0);
+}
+
+//set while the dump screen is up instead of the ram adapter running
+u8 menu_dumping(void)
+{
+  return(dumpscreen);
 }
 
 static void drawmenu(menu_t *menu)
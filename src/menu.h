@@ -1,7 +1,11 @@
 #ifndef __menu_h__
 #define __menu_h__
 
+#include "types.h"
+
 void menu_init(void);
 void menu_tick(void);
+u8 menu_active(void);
+u8 menu_dumping(void);
 
 #endif
@@ -0,0 +1,241 @@
+#include "merge.h"
+#include "../lib/sd-reader/fat.h"
+#include "../lib/sd-reader/fat_config.h"
+
+#if DUMP_PASSES + 1 > FAT_FILE_COUNT
+#error FAT_FILE_COUNT is too small for DUMP_PASSES
+#endif
+
+/*
+Multi pass merge.  Every pass of the disk is written to its own image, and
+the block table says where each block landed and which passes read it with
+a good crc.  The merged image takes each block from the first pass with a
+good crc, or votes on every bit across the passes that at least had the
+block at the same place.  Anything outside of the blocks is copied from the
+first pass.
+*/
+
+#define CHUNK 32
+
+static u8 chunk[DUMP_PASSES][CHUNK];
+
+//a range is read from where it starts on, so only seek once for it
+static u8 seekto(struct fat_file_struct *fd, u32 pos)
+{
+  int32_t offset = pos;
+
+  return(fat_seek_file(fd, &offset, FAT_SEEK_SET));
+}
+
+//copy a range of the image from one pass
+static u8 copyrange(struct fat_file_struct *src, struct fat_file_struct *out, u32 pos, u32 end)
+{
+  if(pos < end && !seekto(src, pos))
+    return(0);
+  while(pos < end) {
+    u8 len = (end - pos) > CHUNK ? CHUNK : (end - pos);
+
+    if(fat_read_file(src, chunk[0], len) != len)
+      return(0);
+    if(fat_write_file(out, chunk[0], len) != len)
+      return(0);
+    pos += len;
+  }
+  return(1);
+}
+
+//bitwise majority of the passes in mask, ties go to the lower pass
+static u8 voterange(struct fat_file_struct **pass, u8 passes, u8 mask, struct fat_file_struct *out, u32 pos, u32 end, u16 *agreed)
+{
+  u8 p, i, bit, n, votes, first;
+
+  for(first = 0; (mask & (1 << first)) == 0; first++);
+
+  *agreed = 0;
+  for(p = 0; p < passes; p++) {
+    if((mask & (1 << p)) && !seekto(pass[p], pos))
+      return(0);
+  }
+  while(pos < end) {
+    u8 len = (end - pos) > CHUNK ? CHUNK : (end - pos);
+
+    for(p = 0; p < passes; p++) {
+      if((mask & (1 << p)) && fat_read_file(pass[p], chunk[p], len) != len)
+        return(0);
+    }
+
+    for(i = 0; i < len; i++) {
+      u8 same = 1, result = 0;
+
+      for(p = first + 1; p < passes; p++) {
+        if((mask & (1 << p)) && chunk[p][i] != chunk[first][i])
+          same = 0;
+      }
+      if(same) {
+        (*agreed)++;
+        continue;
+      }
+
+      for(bit = 0x01; bit; bit <<= 1) {
+        n = votes = 0;
+        for(p = first; p < passes; p++) {
+          if(mask & (1 << p)) {
+            n++;
+            if(chunk[p][i] & bit)
+              votes++;
+          }
+        }
+        if(votes * 2 > n || (votes * 2 == n && (chunk[first][i] & bit)))
+          result |= bit;
+      }
+      chunk[first][i] = result;
+    }
+
+    if(fat_write_file(out, chunk[first], len) != len)
+      return(0);
+    pos += len;
+  }
+  return(1);
+}
+
+//build the merged image in out from the pass images
+u8 merge_passes(struct fat_file_struct **pass, u8 passes, struct fat_file_struct *out, fdsblock_t *table, u8 numblocks)
+{
+  u32 pos = 0;
+  u16 agreed;
+  u8 i, p;
+
+  for(i = 0; i < numblocks; i++) {
+    fdsblock_t *b = &table[i];
+    u32 start = FDS_HEADERSIZE + (u32)b->offset;
+    u32 end = start + b->size;
+
+    //out of order or past the end of the side, leave it to the copy below
+    if(start < pos || b->seen == 0 || end > FDS_HEADERSIZE + (u32)FDS_SIDESIZE)
+      continue;
+
+    //header and anything between blocks
+    if(!copyrange(pass[0], out, pos, start))
+      return(0);
+
+    //a good copy is used as is
+    if(b->crcok) {
+      for(p = 0; (b->crcok & (1 << p)) == 0; p++);
+      if(!copyrange(pass[p], out, start, end))
+        return(0);
+      b->agree = 100;
+    }
+    else {
+      if(!voterange(pass, passes, b->seen, out, start, end, &agreed))
+        return(0);
+      b->agree = (u32)agreed * 100 / b->size;
+    }
+    pos = end;
+  }
+
+  return(copyrange(pass[0], out, pos, FDS_HEADERSIZE + (u32)FDS_SIDESIZE));
+}
+
+static u8 countbits(u8 n)
+{
+  u8 ret = 0;
+
+  for(; n; n >>= 1)
+    ret += n & 1;
+  return(ret);
+}
+
+//append text to a report line
+static char *puttext(char *p, const char *text)
+{
+  while(*text)
+    *p++ = *text++;
+  return(p);
+}
+
+//append a number, padded with spaces on the left to width digits
+static char *putnumber(char *p, u16 n, u8 width)
+{
+  char buf[5];
+  u8 i = 0;
+
+  do {
+    buf[i++] = '0' + n % 10;
+    n /= 10;
+  } while(n);
+  for(; width > i; width--)
+    *p++ = ' ';
+  while(i)
+    *p++ = buf[--i];
+  return(p);
+}
+
+static u8 putline(struct fat_file_struct *fd, char *line, char *p)
+{
+  return(fat_write_file(fd, (u8*)line, p - line) >= 0);
+}
+
+//write a line for every block saying how it was merged
+u8 merge_report(struct fat_file_struct *fd, fdsblock_t *table, u8 numblocks, u8 passes)
+{
+  char line[96], *p;
+  u8 i, good = 0;
+
+  for(i = 0; i < numblocks; i++) {
+    if(table[i].crcok)
+      good++;
+  }
+
+  p = puttext(line, "passes ");
+  p = putnumber(p, passes, 0);
+  p = puttext(p, ", blocks ");
+  p = putnumber(p, numblocks, 0);
+  p = puttext(p, ", good ");
+  p = putnumber(p, good, 0);
+  p = puttext(p, "\r\n\r\n");
+  if(!putline(fd, line, p))
+    return(0);
+
+  for(i = 0; i < numblocks; i++) {
+    fdsblock_t *b = &table[i];
+
+    p = puttext(line, "block ");
+    p = putnumber(p, i, 3);
+
+    //a slot no pass read, a file was missed on every pass
+    if(b->seen == 0) {
+      p = puttext(p, "  not read\r\n");
+      if(!putline(fd, line, p))
+        return(0);
+      continue;
+    }
+
+    p = puttext(p, "  type ");
+    p = putnumber(p, b->type, 0);
+    p = puttext(p, "  offset ");
+    p = putnumber(p, b->offset, 5);
+    p = puttext(p, "  size ");
+    p = putnumber(p, b->size, 5);
+    p = puttext(p, "  read ");
+    p = putnumber(p, countbits(b->seen), 0);
+    *p++ = '/';
+    p = putnumber(p, passes, 0);
+    p = puttext(p, "  crc ok ");
+    p = putnumber(p, countbits(b->crcok), 0);
+    *p++ = '/';
+    p = putnumber(p, passes, 0);
+    p = puttext(p, "  ");
+    if(b->crcok)
+      p = puttext(p, "good\r\n");
+    else if(countbits(b->seen) > 1) {
+      p = puttext(p, "voted, ");
+      p = putnumber(p, b->agree, 0);
+      p = puttext(p, "% agreed\r\n");
+    }
+    else
+      p = puttext(p, "bad\r\n");
+    if(!putline(fd, line, p))
+      return(0);
+  }
+  return(1);
+}
@@ -0,0 +1,22 @@
+#ifndef __merge_h__
+#define __merge_h__
+
+#include "types.h"
+#include "fds.h"
+
+//number of passes for a multi pass dump, each pass file stays open until the
+//merge so this is limited by FAT_FILE_COUNT (passes + the merged image)
+#ifndef DUMP_PASSES
+#define DUMP_PASSES     3
+#endif
+
+#if DUMP_PASSES > 8
+#error DUMP_PASSES can not be more than 8
+#endif
+
+struct fat_file_struct;
+
+u8 merge_passes(struct fat_file_struct **pass, u8 passes, struct fat_file_struct *out, fdsblock_t *table, u8 numblocks);
+u8 merge_report(struct fat_file_struct *fd, fdsblock_t *table, u8 numblocks, u8 passes);
+
+#endif
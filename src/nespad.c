@@ -8,15 +8,37 @@ pin config:
   d2 = latch
   d3 = clock
   d4 = data
+
+when d4 is taken by the icp1 read data input (CAPTURE_ICP=1), or d3 by the
+usart read data output (RA_USART=1):
+  a0 = latch
+  a1 = clock
+  a2 = data
 */
 
+#if CAPTURE_ICP || RA_USART
+#define PAD_DDR     DDRA
+#define PAD_PORT    PORTA
+#define PAD_PIN     PINA
+#define PAD_LATCH   0x01
+#define PAD_CLOCK   0x02
+#define PAD_DATA    0x04
+#else
+#define PAD_DDR     DDRD
+#define PAD_PORT    PORTD
+#define PAD_PIN     PIND
+#define PAD_LATCH   0x04
+#define PAD_CLOCK   0x08
+#define PAD_DATA    0x10
+#endif
+
 u8 paddata;
 
 void nespad_init(void)
 {
-  DDRD |= 0xC;
-  DDRD &= ~0x10;
-  PORTD |= 0x10;
+  PAD_DDR |= PAD_LATCH | PAD_CLOCK;
+  PAD_DDR &= ~PAD_DATA;
+  PAD_PORT |= PAD_DATA;
   paddata = 0;
 }
 
@@ -25,16 +47,16 @@ void nespad_poll()
   u8 ret = 0;
   int i;
 
-  PORTD |= 4;
+  PAD_PORT |= PAD_LATCH;
   _delay_ms(1);
-  PORTD &= ~4;
-  ret = (PIND & 0x10) >> 4;
+  PAD_PORT &= ~PAD_LATCH;
+  ret = (PAD_PIN & PAD_DATA) ? 1 : 0;
   for(i=0;i<7;i++) {
-    PORTD |= 8;
+    PAD_PORT |= PAD_CLOCK;
     _delay_ms(1);
     ret <<= 1;
-    ret |= (PIND & 0x10) >> 4;
-    PORTD &= ~8;
+    ret |= (PAD_PIN & PAD_DATA) ? 1 : 0;
+    PAD_PORT &= ~PAD_CLOCK;
     _delay_ms(1);
   }
   paddata = ret ^ 0xFF;
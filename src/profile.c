@@ -0,0 +1,207 @@
+#include <string.h>
+#include <avr/eeprom.h>
+#include "profile.h"
+#include "fds.h"
+#include "ramadapter.h"
+
+#define PROFILE_VERSION     3
+
+//a title looked up before and the timing found for it
+typedef struct profslot_s {
+  char id[PROFILE_IDSIZE];
+  profile_t p;
+} __attribute__((packed)) profslot_t;
+
+//eeprom layout (avr structs have no padding), erased eeprom has the
+//version 0xFF
+typedef struct profeeprom_s {
+  u8 version;
+  u8 turbo;
+  u32 stamp;            //of the profile file the cache was filled from
+  u8 next;              //slot the next title goes in
+  profslot_t slot[PROFILE_CACHE];
+} profeeprom_t;
+
+static profeeprom_t ee EEMEM;
+
+//the profile file, if there is one
+static struct fat_fs_struct *proffs;
+static struct fat_dir_entry_struct proffile;
+static u8 proffound;
+
+//file being read and what is left of its last read
+static struct fat_file_struct *in;
+static u8 buf[32];
+static u8 bufpos, buflen;
+
+static const profile_t standard = {FDS_GAP_FIRST, FDS_GAP_BLOCK, 100};
+static const profile_t turbo = {PROFILE_TURBO_FIRST, PROFILE_TURBO_BLOCK, PROFILE_TURBO_RATE};
+
+//next byte of the file, -1 at the end of it
+static s16 readbyte(void)
+{
+  if(bufpos == buflen) {
+    intptr_t n = fat_read_file(in, buf, sizeof(buf));
+
+    if(n <= 0)
+      return(-1);
+    buflen = n;
+    bufpos = 0;
+  }
+  return(buf[bufpos++]);
+}
+
+//read the next line into line, cut to size - 1 characters.  returns 0 at
+//the end of the file.
+static u8 readline(char *line, u8 size)
+{
+  s16 c;
+  u8 n = 0;
+
+  while((c = readbyte()) >= 0 && c != '\n') {
+    if(c != '\r' && n < size - 1)
+      line[n++] = c;
+  }
+  line[n] = 0;
+  return(c >= 0 || n != 0);
+}
+
+static u8 openfile(void)
+{
+  if(proffound == 0 || (in = fat_open_file(proffs, &proffile)) == 0)
+    return(0);
+  bufpos = buflen = 0;
+  return(1);
+}
+
+//skip spaces and read a number into n, stuck at 0xFFFF if it is bigger.
+//returns 0 if there is none.
+static u8 number(const char **s, u16 *n)
+{
+  u32 v = 0;
+  u8 digits = 0;
+
+  while(**s == ' ' || **s == '\t')
+    (*s)++;
+  for(; **s >= '0' && **s <= '9'; digits++) {
+    v = v * 10 + *(*s)++ - '0';
+    if(v > 0xFFFF)
+      v = 0xFFFF;
+  }
+  *n = v;
+  return(digits != 0);
+}
+
+//look a title up in the profile file, turbo timing if it is not listed
+static void lookup(const char *id, profile_t *p)
+{
+  char line[32];
+
+  *p = turbo;
+  if(openfile() == 0)
+    return;
+  while(readline(line, sizeof(line))) {
+    const char *s = &line[PROFILE_IDSIZE];
+    u16 lead, block, rate;
+
+    if(line[0] == '#' || strlen(line) < PROFILE_IDSIZE || memcmp(line, id, PROFILE_IDSIZE))
+      continue;
+
+    //std, or a line with a gap or rate out of range, gets the standard timing
+    *p = standard;
+    if(number(&s, &lead) == 0 || number(&s, &block) == 0)
+      break;
+    if(number(&s, &rate) == 0)
+      rate = 100;
+    if(lead >= PROFILE_LEAD_MIN && lead <= PROFILE_LEAD_MAX &&
+       block >= PROFILE_BLOCK_MIN && block <= PROFILE_BLOCK_MAX &&
+       rate >= RA_RATE_MIN && rate <= RA_RATE_MAX) {
+      p->leadgap = lead;
+      p->blockgap = block;
+      p->rate = rate;
+    }
+    break;
+  }
+  fat_close_file(in);
+}
+
+/*
+Find the profile file and check the cache was filled from it as it is now,
+emptying the cache if it was not.  The stamp is made from the whole file,
+which is small.
+*/
+void profile_init(struct fat_fs_struct *fs, struct fat_dir_struct *root)
+{
+  u32 stamp = 0;
+  s16 c;
+
+  proffs = fs;
+  proffound = 0;
+  fat_reset_dir(root);
+  while(fat_read_dir(root, &proffile)) {
+    if(strcmp(proffile.long_name, PROFILE_NAME) == 0) {
+      proffound = 1;
+      break;
+    }
+  }
+  fat_reset_dir(root);
+
+  if(openfile()) {
+    while((c = readbyte()) >= 0)
+      stamp = ((stamp << 3) | (stamp >> 29)) + (u8)c;
+    fat_close_file(in);
+  }
+
+  if(eeprom_read_byte(&ee.version) != PROFILE_VERSION) {
+    eeprom_update_byte(&ee.version, PROFILE_VERSION);
+    eeprom_update_byte(&ee.turbo, 1);
+  }
+  else if(eeprom_read_dword(&ee.stamp) == stamp)
+    return;
+
+  for(c = 0; c < PROFILE_CACHE; c++)
+    eeprom_update_byte((u8*)ee.slot[c].id, 0xFF);
+  eeprom_update_byte(&ee.next, 0);
+  eeprom_update_dword(&ee.stamp, stamp);
+}
+
+//turbo mode, kept in eeprom
+u8 profile_turbo(void)
+{
+  return(eeprom_read_byte(&ee.turbo) == 1);
+}
+
+void profile_setturbo(u8 on)
+{
+  eeprom_update_byte(&ee.turbo, on ? 1 : 0);
+}
+
+//timing to play the title with disk id id with
+void profile_get(const char *id, profile_t *p)
+{
+  profslot_t slot;
+  u8 i;
+
+  if(profile_turbo() == 0) {
+    *p = standard;
+    return;
+  }
+
+  for(i = 0; i < PROFILE_CACHE; i++) {
+    eeprom_read_block(&slot, &ee.slot[i], sizeof(slot));
+    if(memcmp(slot.id, id, PROFILE_IDSIZE) == 0) {
+      *p = slot.p;
+      return;
+    }
+  }
+
+  //not cached, the oldest title cached makes room for it
+  lookup(id, p);
+  memcpy(slot.id, id, PROFILE_IDSIZE);
+  slot.p = *p;
+  i = eeprom_read_byte(&ee.next);
+  if(i >= PROFILE_CACHE)
+    i = 0;
+  eeprom_update_block(&slot, &ee.slot[i], sizeof(slot));
+  eeprom_update_byte(&ee.next, (i + 1) % PROFILE_CACHE);
+}
@@ -0,0 +1,61 @@
+#ifndef __profile_h__
+#define __profile_h__
+
+#include "types.h"
+#include "fds.h"
+#include "../lib/sd-reader/fat.h"
+
+/*
+Load timing profiles.  In turbo mode the gaps on the disk are cut down from
+what a real drive has to what the bios still reads, which is most of the time
+a load takes.  Games that need more are listed by disk id in a text file in
+the root directory, one per line:
+
+  ZEL  std            standard timing
+  KIK  600 40         gap before the first block and between blocks, in bytes
+  SMB  600 40 104     and the bit rate in percent of 96.4khz (100 if not given)
+  # a comment
+
+The id is the 3 character game name and the game type byte from the disk info
+block (a space for type ' ').  A listed game is played with its own timing,
+any other with turbo timing.  Lookups are cached in eeprom with a stamp of
+the file, so the file is only read for a game not seen since it changed.
+*/
+
+#define PROFILE_NAME        "profiles.txt"
+
+//disk id, from FDS_TITLE_POS in the disk info block
+#define PROFILE_IDSIZE      4
+
+//turbo gaps in bytes of 0 bits.  the bios needs a little of the first gap
+//to start reading after it sees ready, the block gaps are where it checks
+//each block and sets up for the next.
+#define PROFILE_TURBO_FIRST 600
+#define PROFILE_TURBO_BLOCK 40
+
+//turbo bit rate in percent, leaving some of the ram adapter's 10% tolerance
+//as margin
+#define PROFILE_TURBO_RATE  107
+
+//what a listed gap may be, a line outside of it (or with a bit rate outside
+//of the ram adapter's tolerance) gets the standard timing
+#define PROFILE_LEAD_MIN    100
+#define PROFILE_LEAD_MAX    (FDS_GAP_FIRST * 2)
+#define PROFILE_BLOCK_MIN   16
+#define PROFILE_BLOCK_MAX   255
+
+//titles cached in eeprom
+#define PROFILE_CACHE       16
+
+typedef struct profile_s {
+  u16 leadgap;          //before the first block, the ring priming gap included
+  u8 blockgap;          //between blocks
+  u8 rate;              //percent of the nominal bit rate
+} __attribute__((packed)) profile_t;
+
+void profile_init(struct fat_fs_struct *fs, struct fat_dir_struct *root);
+u8 profile_turbo(void);
+void profile_setturbo(u8 on);
+void profile_get(const char *id, profile_t *p);
+
+#endif
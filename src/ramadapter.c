@@ -2,10 +2,15 @@
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
+#include <string.h>
 #include "ramadapter.h"
-
-#include "allnight-part1.h"
-#include "allnight-part2.h"
+#include "ring.h"
+#include "fds.h"
+#include "diskdrive.h"
+#include "writeback.h"
+#include "flashstore.h"
+#include "profile.h"
+#include "../lib/sd-reader/fat.h"
 
 /*
 pin config:
@@ -18,7 +23,34 @@ read data     = f4 (output) (also tied to b5)
 rw media      = f5 (output) (active low)
 write         = f6 (input)
 scan media    = f7 (input)  (active low)
-write data    = d5 (input)  (active low)
+write data    = e5 (input)  (active low)
+
+with RA_USART=1 read data comes from d3 (txd1) instead of f4.  d5 is the
+usart clock output then, and the nes pad moves to port a.
+
+with RA_PCINT=1 stop motor, write and scan media are also tied to b4, b6 and
+b7 (pcint4, 6 and 7) and read from there.  they stay inputs in drive mode.
+*/
+
+/*
+Control.  The inputs from the ram adapter drive a state machine, run by
+control() on every change of them:
+
+  idle        motor stopped (or no disk), ready and motor on inactive
+  spinup      motor on, waiting for scan media
+  ready       ready given, waiting for the ring to be primed
+  transfer    sending the disk
+  stopping    motor stopped after a transfer, the tick saves what was
+              written and primes the ring at the start of the side again
+
+The ring is kept primed at the start of the side whenever no transfer is
+going on, so a transfer starts as soon as scan media does.  With RA_PCINT=1
+control() runs in the pin change interrupt and the responses are there a few
+microseconds after the inputs change, whatever the main loop is doing.  The
+tick runs it as well, to pick up levels that were there before an image or
+side change.  Otherwise the tick polls the inputs and runs it.  Writes are
+started and ended by the tick either way, as they use the reader and the sd
+card, which the tick is using.
 */
 
 /*
@@ -35,46 +67,207 @@ to it's physical architecture.
 
 166 is close enough
 166 / 2 = 83 for clock up -> down transitioning
+
+The rate is set in percent of 96.4khz (ramadapter_setrate), up to the edge
+of the tolerance to load faster.  The half bit period is kept in 1/256ths of
+a cycle: the whole part goes in OCR1A and the fraction is added up every
+interrupt, making that half bit a cycle longer each time it carries.  So the
+periods alternate between two compare values and average out to the rate
+exactly, 96.4khz itself is 82.99 cycles.
+
+With RA_USART=1 the same waveform comes out of usart1 in spi master mode,
+clocked at 16000000 / (2 * (41 + 1)) = 190476hz, one usart bit per half bit
+cell like the timer (84 cycles).  Each data bit b is sent as the pair b, !b
+(low half first, as the timer interrupt does), so a data byte is two usart
+bytes, looked up a nibble at a time.  The data register empty interrupt runs
+once per 4 bit cells instead of twice per bit cell.  The fraction is carried
+into UBRR1 the same way, a usart byte at a time.
+*/
+
+/*
+Playback.  The image is either a .fds image, which is turned into the disk
+bitstream as it is read (fds_reader_read adds the gaps, start marks and
+crcs), or a disk bitstream as is.  Either way it is read from the sd card
+into a ring of 256 byte slots (ring.h) by ramadapter_tick, and sent from the
+ring by the timer interrupt, each byte lsb first.  One slot lasts
+256 * 8 / 96.4khz = 21ms, the ring keeps RING_SLOTS - 1 of them (63ms with
+the default 4) ready, which covers a 512 byte sd read plus reading the fat
+for the next cluster many times over.  Underruns are counted by the ring
+and sent as 0 bits.
+
+The gaps and bit rate of a .fds image are set by its profile (profile.c),
+turbo timing unless the title needs the standard timing.  A bitstream image
+has its own.
+*/
+
+/*
+Writes.  Write data is timed the way read data is when dumping, the interval
+between falling edges on e5 (int5) in timer3 ticks at 2mhz, and decoded into
+blocks by the decoder diskdrive.c dumps with, which is idle while emulating.
+Playback is paused for the write so the interrupt has the cpu to itself, and
+skipped ahead by the bits written when it ends, as the disk would have turned.
+Where the write goes comes from how far into the disk the head was when it
+started (fds_reader_locate).  The blocks are patched into pages held in ram
+(writeback.c) and saved to the image after the motor stops.  Only .fds images
+are written to, writes to a bitstream image are ignored.
 */
 
-volatile u8 toggle;
-volatile u8 sending;
+static volatile u8 toggle;
 
-//buffer for storing disk data read off of the disk
-volatile u8 bufferpos,curbuffer;
-volatile u8 buffer[2][256];
+//ring of image data for the timer interrupt to send, lent out while the
+//connector is the drive's (ramadapter_borrow)
+static ring_t playring;
 
-//total size of the current block we are sending (includes start byte and crc)
-volatile int blocksize;
+//image being played back, and set once all of it has been read
+static struct fat_file_struct *image;
+static u8 imageend;
 
-//for when disk is being read from a gap period
-volatile u16 gapperiod;
+//set if the image is a .fds image, sent through the reader, with where its
+//sides start and the side in the drive
+static u8 imagefds;
+static fdsreader_t reader;
+static fdsindex_t sideindex;
+static u8 side;
 
-//the current bit/byte being output
-volatile u8 outbit,outbyte;
+//for when disk is being read from a gap period, in bits
+static volatile u16 gapperiod;
+
+//bits of gap sent before the image data starts, at most.  the rest of the
+//first gap comes from the reader.
+#define GAP_BITS  14000
+
+//gaps the image is played back with, and the part of the first one sent
+//while the ring is primed
+static profile_t timing;
+static u16 leadbits;
+
+//the current byte being output
+static volatile u8 outbyte;
 
 //number of bits from the current byte being output
-volatile u8 bitssent;
+static volatile u8 bitssent;
 
-//for requesting a buffer be filled (0 = do nothing, 1 = fill buffer 1, 2 = fill buffer 2)
-volatile u8 fillbuffer;
+//how long the disk is out of the drive when the side is changed
+#define SIDE_EJECT_MS   500
 
 //this flag is set when we are transferring to/from the ram adapter
-volatile u8 transfer;
+static volatile u8 transfer;
+
+//control state, and set while the ring is primed at the start of the side
+static volatile u8 state;
+static volatile u8 armed;
+
+//set while the write line is active, if the write is being captured, and
+//if the writeback refused some of it.  writes that could not be saved are
+//counted for the debug screen.
+static u8 writing;
+static u8 capturing;
+static u8 writefailed;
+static u8 writefails;
+
+//timer3 count at the last write data edge
+static volatile u16 lastedge;
+
+//bit rate: percent of nominal, and the period the serializer is programmed
+//with, whole cycles (less one, as the register takes it) and 1/256ths
+static u8 ratepercent;
+static volatile u8 ratewhole, ratefrac;
+static volatile u8 rateacc;
+
+#if RA_USART
+
+//cycles per usart bit (half a bit cell) is 2 * (UBRR1 + 1)
+#define RA_PERIOD_SHIFT 6
+
+//a gap byte, four 0 bits
+#define RA_GAPBYTE  0xAA
+
+//set when the high nibble of outbyte is next
+static volatile u8 outhigh;
+
+//data nibble to usart byte, sent lsb first: bit n goes out as n, !n
+static const u8 expand[16] = {
+  0xAA, 0xA9, 0xA6, 0xA5, 0x9A, 0x99, 0x96, 0x95,
+  0x6A, 0x69, 0x66, 0x65, 0x5A, 0x59, 0x56, 0x55,
+};
+
+//usart data register empty, send the next 4 bit cells
+ISR(USART1_UDRE_vect)
+{
+  u8 acc = rateacc + ratefrac;
+
+  //next byte a usart clock longer if the fraction carries
+  UBRR1 = (acc < rateacc) ? ratewhole + 1 : ratewhole;
+  rateacc = acc;
+
+  //gap period, 4 0 bits at a time
+  if(gapperiod) {
+    UDR1 = RA_GAPBYTE;
+    gapperiod = (gapperiod > 4) ? gapperiod - 4 : 0;
+    return;
+  }
+
+  if(outhigh == 0) {
+    UDR1 = expand[outbyte & 0x0F];
+    outhigh = 1;
+  }
+  else {
+    UDR1 = expand[outbyte >> 4];
+    outhigh = 0;
+
+    //get next byte from the ring
+    outbyte = ring_getbyte(&playring);
+  }
+}
+
+static void serializer_init(void)
+{
+  //spi master mode, lsb first, sample on rising edge
+  UBRR1 = 0;
+  DDRD |= 0x28;     //d3 (txd1) and d5 (xck1) as outputs
+  UCSR1C = (1 << UMSEL11) | (1 << UMSEL10) | (1 << UDORD1);
+  UCSR1B = (1 << TXEN1);
+  UBRR1 = ratewhole;
+}
+
+//start sending, the interrupt fires as soon as it is enabled
+static void serializer_start(void)
+{
+  outhigh = 0;
+  transfer = 1;
+  UCSR1B |= (1 << UDRIE1);
+}
+
+static void serializer_stop(void)
+{
+  UCSR1B &= ~(1 << UDRIE1);
+  transfer = 0;
+}
+
+#else
 
 //timer interrupt for sending data out to the ram adapter
 ISR(TIMER1_COMPA_vect)
 {
+  u8 acc;
+
   //if we are not transferring, return
   if(transfer == 0)
     return;
 
+  //next half bit a cycle longer if the fraction carries
+  acc = rateacc + ratefrac;
+  OCR1A = (acc < rateacc) ? ratewhole + 1 : ratewhole;
+  rateacc = acc;
+
   //toggle the phony clock
   toggle ^= 1;
 
   //if this is gap period just keep toggling with the rate
   if(gapperiod) {
     PORTF ^= 0x10;
+    if(toggle == 0)
+      gapperiod--;
     return;
   }
 
@@ -96,14 +289,8 @@ ISR(TIMER1_COMPA_vect)
     if(bitssent == 8) {
       bitssent = 0;
 
-      //get next byte from the buffer
-      outbyte = buffer[curbuffer][bufferpos++];
-
-      //if that was the last byte, request buffer be filled and switch buffers
-      if(bufferpos == 0) {
-        fillbuffer = curbuffer;
-        curbuffer ^= 1;
-      }
+      //get next byte from the ring
+      outbyte = ring_getbyte(&playring);
     }
   }
 
@@ -113,40 +300,312 @@ ISR(TIMER1_COMPA_vect)
   }
 }
 
-u16 crc;
+static void serializer_init(void)
+{
+  //initialize timer (for sending data), the drive may have left it set up
+  //for input capture
+  TCCR1A = 0;
+  TCCR1B = (1 << WGM12); // Configure timer 1 for CTC mode
+  TIMSK1 |= (1 << OCIE1A); // Enable CTC interrupt
+//  TCNT1   = 83;
+  OCR1A   = ratewhole;
+  TCCR1B |= 1; // Start timer at Fcpu
+}
+
+//cycles per half bit cell is OCR1A + 1
+#define RA_PERIOD_SHIFT 7
+
+static void serializer_start(void)
+{
+  toggle = 0;
+  transfer = 1;
+}
+
+static void serializer_stop(void)
+{
+  transfer = 0;
+}
+
+#endif
+
+/*
+Set the bit rate in percent of 96.4khz, kept inside the tolerance of the ram
+adapter.  The period is worked out in 1/256ths of a serializer count:
+F_CPU / rate cycles per bit cell, over 2 for the half cells the timer counts,
+or over 4 for the usart, whose bit is half a cell and counts pairs of cycles.
+*/
+void ramadapter_setrate(u8 percent)
+{
+  u32 period;
+
+  if(percent < RA_RATE_MIN)
+    percent = RA_RATE_MIN;
+  if(percent > RA_RATE_MAX)
+    percent = RA_RATE_MAX;
+  ratepercent = percent;
+  period = (F_CPU << RA_PERIOD_SHIFT) / (RA_RATE_NOMINAL / 100 * percent);
+
+  cli();
+  ratewhole = (period >> 8) - 1;
+  ratefrac = (u8)period;
+  rateacc = 0;
+  sei();
+}
+
+u8 ramadapter_rate(void)
+{
+  return(ratepercent);
+}
+
+//bit rate in hz the serializer averages out to
+u32 ramadapter_ratehz(void)
+{
+  u32 period = ((u32)(ratewhole + 1) << 8) + ratefrac;
+
+  return((F_CPU << RA_PERIOD_SHIFT) / period);
+}
 
-//fron nesdev board.  thanks bisquit
-static void updatecrc(u8 data)
+//write data edge, time it and decode it
+ISR(INT5_vect)
 {
-  u8 c;
-  int n;
+  u16 now = TCNT3;
+  u16 time = now - lastedge;
 
-  for(n = 0x01; n <= 0x80; n = n << 1) {
-    c = (u8)(crc & 1);
-    crc >>= 1;
-    if(c)
-      crc = crc ^ 0x8408;
-    if(data & n)
-      crc = crc ^ 0x8000;
+  lastedge = now;
+  decoder_edge(&decoder,(time > 0xFF) ? 0xFF : (u8)time);
+}
+
+static void writer_init(void)
+{
+  //write data is on e5, falling edges
+  DDRE &= ~0x20;
+  PORTE |= 0x20;
+  EIMSK &= ~(1 << INT5);
+  EICRB = (EICRB & ~((1 << ISC51) | (1 << ISC50))) | (1 << ISC51);
+
+  //timer3 free running at 2mhz
+  TIMSK3 = 0;
+  TCCR3A = 0;
+  TCCR3B = 0x02;
+}
+
+//fill every free slot of the ring from the image, with 0 past its end
+static void refill(void)
+{
+  volatile u8 *slot;
+
+  while((slot = ring_free(&playring)) != 0) {
+    intptr_t len = 0;
+
+    if(imageend == 0) {
+      if(imagefds)
+        len = fds_reader_read(&reader,(u8*)slot,256);
+      else if(image)
+        len = fat_read_file(image,(u8*)slot,256);
+    }
+    if(len < 256) {
+      if(len < 0)
+        len = 0;
+      memset((u8*)slot + len,0,256 - len);
+      imageend = 1;
+    }
+    ring_commit(&playring);
   }
 }
 
-//current position on the disk
-int diskpos = 0;
+//go back to the start of the image and fill the ring
+static void image_rewind(void)
+{
+  int32_t offset = 0;
+
+  ring_init(&playring);
+  imageend = 0;
+  if(imagefds)
+    fds_reader_open(&reader,&sideindex,side,timing.leadgap - leadbits / 8,timing.blockgap,writeback_patch);
+  else if(image && fat_seek_file(image,&offset,FAT_SEEK_SET) == 0)
+    imageend = 1;
+  refill();
+  armed = 1;
+}
+
+//stop sending and take the ring back from the interrupt before it is
+//changed, the state machine starts over once the ring is primed again
+static void playback_stop(void)
+{
+  cli();
+  serializer_stop();
+  armed = 0;
+  state = RA_IDLE;
+  sei();
+}
 
-//current disk side
-u8 diskside = 0;
+//look up the gaps and bit rate for the image by its disk id
+static void settiming(void)
+{
+  char id[PROFILE_IDSIZE];
+
+  timing.leadgap = FDS_GAP_FIRST;
+  timing.blockgap = FDS_GAP_BLOCK;
+  timing.rate = 100;
+  if(imagefds && fds_read_side(&sideindex,0,FDS_TITLE_POS,(u8*)id,sizeof(id)))
+    profile_get(id,&timing);
+  leadbits = GAP_BITS;
+  if(imagefds && (u32)timing.leadgap * 8 < GAP_BITS)
+    leadbits = timing.leadgap * 8;
+  ramadapter_setrate(timing.rate);
+}
 
-static u8 getdiskbyte(void)
+//set the image to play back (0 for none, the disk is then all gap).  .fds
+//images are recognized, their sides indexed and encoded on the fly.
+void ramadapter_image(struct fat_file_struct *fd)
 {
-  int pos = diskpos + 16;
-  u8 data;
+  playback_stop();
+
+  //save what was written to the last one
+  while(writeback_flush())
+    ;
+
+  image = fd;
+  imagefds = fd ? (fds_index(&sideindex,fd) != 0) : 0;
+  side = 0;
+  writeback_open(imagefds ? fd : 0);
+  writefails = 0;
+  settiming();
+  image_rewind();
+}
 
-  if(pos < 32758)
-    data = pgm_read_byte(allnight1 + pos);
-  else
-    data = pgm_read_byte(allnight2 + (pos - 32758));
-  return(data);
+//number of times the timer interrupt found the ring empty
+u16 ramadapter_underruns(void)
+{
+  return(playring.underruns);
+}
+
+//number of writes that did not fit in the writeback and were not saved
+u8 ramadapter_writefails(void)
+{
+  return(writefails);
+}
+
+//hand the decoded write data to the writeback, the partly filled slot too if
+//the write has ended
+static void write_drain(u8 last)
+{
+  volatile u8 *slot;
+  u8 len;
+
+  while((slot = ring_full(&decoder.ring)) != 0) {
+    if(writeback_data((u8*)slot,256) == 0)
+      writefailed = 1;
+    ring_release(&decoder.ring);
+  }
+  if(last) {
+    slot = decoder_finish(&decoder,&len);
+    if(writeback_data((u8*)slot,len) == 0 || writeback_end() == 0)
+      writefailed = 1;
+    if(writefailed)
+      writefails++;
+  }
+}
+
+//the write line went active, pause playback and start capturing
+static void write_start(void)
+{
+  const fdsmark_t *m;
+  u32 head;
+
+  serializer_stop();
+  writing = 1;
+  capturing = 0;
+
+  //bytes the head is past, the one being sent counts as passed
+  head = reader.stream - ((u32)ring_used(&playring) * 256 - playring.rpos);
+  if(imagefds == 0 || gapperiod || (m = fds_reader_locate(&reader,head)) == 0)
+    return;
+
+  decoder_init(&decoder,DUMP_FDS);
+  writefailed = 0;
+  decoder.filesize = writeback_start(m->offset,m->filesize,m->type == 0);
+  lastedge = TCNT3;
+  EIFR = (1 << INTF5);
+  EIMSK |= (1 << INT5);
+  capturing = 1;
+}
+
+//the write line went inactive (or the motor stopped), take the rest of the
+//write and carry on playing back from where the head is now
+static void write_end(void)
+{
+  u32 skip = 0;
+
+  if(capturing) {
+    EIMSK &= ~(1 << INT5);
+    write_drain(1);
+    skip = decoder_bits(&decoder) / 8;
+  }
+  writing = 0;
+  capturing = 0;
+  if(state != RA_TRANSFER)
+    return;
+
+  //the disk turned under the head while it was being written
+  while(skip--) {
+    if(ring_used(&playring) == 0)
+      refill();
+    ring_getbyte(&playring);
+  }
+
+  //unless the motor stopped meanwhile
+  cli();
+  if(state == RA_TRANSFER) {
+    bitssent = 0;
+    outbyte = ring_getbyte(&playring);
+    serializer_start();
+  }
+  sei();
+}
+
+//play back image n of the flash store, nothing is written back to it
+u8 ramadapter_flashimage(u8 n)
+{
+  flashimage_t img;
+
+  ramadapter_image(0);
+  if(flashstore_get(n,&img) == 0)
+    return(0);
+  imagefds = (fds_index_flash(&sideindex,&img) != 0);
+  settiming();
+  image_rewind();
+  return(imagefds);
+}
+
+//number of sides the image has, a bitstream image has one
+u8 ramadapter_sides(void)
+{
+  return(imagefds ? sideindex.sides : 1);
+}
+
+u8 ramadapter_curside(void)
+{
+  return(side);
+}
+
+//put another side of the image in the drive.  the disk is taken out and put
+//back so the bios sees the change, and the next transfer starts at the new
+//side from its indexed cluster.
+void ramadapter_side(u8 n)
+{
+  if(n >= ramadapter_sides() || n == side)
+    return;
+  if(writing)
+    write_end();
+  playback_stop();
+  ramadapter_motoron(0);
+
+  ramadapter_mediaset(0);
+  side = n;
+  image_rewind();
+  _delay_ms(SIDE_EJECT_MS);
+  ramadapter_mediaset(1);
 }
 
 /*
@@ -159,7 +618,7 @@ FDS games rely on this, therefore for writable disks, the "-write enable"
 flag should be activated simultaniously with "-media set".
 */
 
-rastate_t rastate;
+volatile rastate_t rastate;
 
 void ramadapter_mediaset(u8 state)
 {
@@ -208,128 +667,189 @@ void ramadapter_outputbit(u8 bit)
 
 void ramadapter_poll(void)
 {
-  rastate.stopmotor = (PINF & 1) ? 0 : 1;
-  rastate.scanmedia = (PINF & 0x80) ? 0 : 1;
-  rastate.write = (PINF & 0x40) ? 0 : 1;
+#if RA_PCINT
+  u8 pins = PINB;
+
+  rastate.stopmotor = (pins & 0x10) ? 0 : 1;
+  rastate.scanmedia = (pins & 0x80) ? 0 : 1;
+  rastate.write = (pins & 0x40) ? 0 : 1;
+#else
+  u8 pins = PINF;
+
+  rastate.stopmotor = (pins & 1) ? 0 : 1;
+  rastate.scanmedia = (pins & 0x80) ? 0 : 1;
+  rastate.write = (pins & 0x40) ? 0 : 1;
+#endif
+}
+
+//read the inputs and move the state machine on, see the top of the file.
+//runs with interrupts off.
+static void control(void)
+{
+  ramadapter_poll();
+
+  //motor stopped or no disk, stop sending
+  if(rastate.stopmotor || rastate.mediaset == 0) {
+    if(state == RA_READY || state == RA_TRANSFER) {
+      serializer_stop();
+      state = armed ? RA_IDLE : RA_STOPPING;
+    }
+    else if(state == RA_SPINUP)
+      state = RA_IDLE;
+    ramadapter_ready(0);
+    ramadapter_motoron(0);
+    return;
+  }
+
+  /*- It is okay to tie "-ready" up to the "-scan media" signal, if the media 
+  needs no time to prepare for a data xfer after "-scan media" is activated. 
+  Don't try to tie "-ready" active all the time- while this will work for 95% 
+  of the disk games i've tested, some will not load unless "-ready" is 
+  disabled after a xfer. */
+  ramadapter_motoron(1);
+  ramadapter_ready(rastate.scanmedia);
+
+  if(state == RA_IDLE)
+    state = RA_SPINUP;
+  if(state == RA_SPINUP && rastate.scanmedia)
+    state = RA_READY;
+
+  //start from the beginning of the side, the ring is full of it
+  if(state == RA_READY && armed) {
+    armed = 0;
+    gapperiod = leadbits;
+    bitssent = 0;
+    outbyte = ring_getbyte(&playring);
+    serializer_start();
+    state = RA_TRANSFER;
+  }
+}
+
+#if RA_PCINT
+ISR(PCINT0_vect)
+{
+  control();
+}
+#endif
+
+//where the state machine is, for the debug screen
+u8 ramadapter_state(void)
+{
+  return(state);
 }
 
 void ramadapter_init(void)
 {
   //set port input/outputs
   DDRF = 0x3E;
-  DDRD &= ~0x20;
 
   //enable pullups
   PORTF |= 0xC1;
-  PORTD |= 0x20;
+#if RA_PCINT
+  DDRB &= ~0xD0;
+  PORTB |= 0xD0;
+#endif
 
-  //initialize timer (for sending data)
-  TCCR1B |= (1 << WGM12); // Configure timer 1 for CTC mode
-  TIMSK1 |= (1 << OCIE1A); // Enable CTC interrupt
-//  TCNT1   = 83;
-  OCR1A   = 83;
-  TCCR1B |= 1; // Start timer at Fcpu
+  ramadapter_setrate(100);
+  serializer_init();
+  writer_init();
 
   ramadapter_mediaset(1);
   ramadapter_motoron(0);
   ramadapter_ready(0);
 //  ramadapter_rwmedia(1);
 
-  diskpos = 0;
-  diskside = 0;
-  transfer = 0;
+  serializer_stop();
   bitssent = 0;
   toggle = 0;
+  state = RA_IDLE;
+  armed = 0;
+
+#if RA_PCINT
+  //any change of stop motor, write or scan media
+  PCMSK0 = 0xD0;
+  PCIFR = (1 << PCIF0);
+  PCICR |= (1 << PCIE0);
+#endif
 }
 
-//returns 1 if we are currently sending data
-u8 ramadapter_tick(void)
+//stop playing, save what was written and let go of the connector for the
+//drive.  the outputs go inactive and the interrupts off until ramadapter_init.
+void ramadapter_release(void)
 {
-  //poll ramadapter inputs
-  ramadapter_poll();
-
-  /*- It is okay to tie "-ready" up to the "-scan media" signal, if the media 
-  needs no time to prepare for a data xfer after "-scan media" is activated. 
-  Don't try to tie "-ready" active all the time- while this will work for 95% 
-  of the disk games i've tested, some will not load unless "-ready" is 
-  disabled after a xfer. */
-//  ramadapter_ready(rastate.scanmedia);
-  ramadapter_ready((rastate.scanmedia && rastate.motoron) ? 1 : 0);
+  if(writing)
+    write_end();
+  playback_stop();
+  while(writeback_flush())
+    ;
 
-  //see if we need more data
-  if(fillbuffer) {
-    //fill buffer here!
-    fillbuffer = 0;
-  }
-
-  //check if timer interrupt has happened
-/*  if(timerint) {
-
-    //see if we are sending data
-    if(sending) {
-
-      //listen to 'stopmotor' command
-      if(rastate.stopmotor) {
-        sending = 0;
-        ramadapter_motoron(0);
-      }
-
-      //output data
-      outbit = (diskbyte >> bitssent) & 1;
-      if(outbit) {
-        PORTF |= 0x10;
-      }
-      else {
-        PORTF &= ~0x10;
-      }
-
-      //increment sent bits count and check if we need more data
-      bitssent++;
-      if(bitssent == 8) {
-        needbyte = 1;
-        bitssent = 0;
-      }
-    }
-  }*/
+  ramadapter_mediaset(0);
+  ramadapter_motoron(0);
+  ramadapter_ready(0);
 
-  //if we are sending/recieving data, tell main loop to not do anything!
-  if(transfer) {
+#if RA_USART
+  UCSR1B = 0;
+#else
+  TIMSK1 &= ~(1 << OCIE1A);
+#endif
+  EIMSK &= ~(1 << INT5);
+  TCCR3B = 0;
+#if RA_PCINT
+  PCICR &= ~(1 << PCIE0);
+#endif
+}
 
-    //listen to 'stopmotor' command
-    if(rastate.stopmotor) {
-      transfer = 0;
-      ramadapter_motoron(0);
-    }
+/*
+The play ring's slots for the dump to keep its block table in, 0 if size
+does not fit.  Only good from ramadapter_release until ramadapter_init, the
+ring is primed again from the image after that.  The capture ring can not be
+shared the same way, writes are captured into it while playing back.
+*/
+void *ramadapter_borrow(u16 size)
+{
+  if(size > sizeof(playring.slot))
+    return(0);
+  return((void*)playring.slot);
+}
 
-    return(1);
+//returns 1 if we are currently sending data
+u8 ramadapter_tick(void)
+{
+  cli();
+  control();
+  sei();
+
+  //keep the ring ahead of the timer interrupt
+  if(transfer)
+    refill();
+
+  //follow the write line
+  if(transfer && rastate.write)
+    write_start();
+  else if(writing) {
+    if(rastate.write == 0 || state != RA_TRANSFER)
+      write_end();
+    else if(capturing)
+      write_drain(0);
   }
 
-  //if the motor is running...
-  if(rastate.stopmotor == 0) {
-    ramadapter_motoron(1);
-
-    //...and ram adapter set scanmedia, we must be transferring data
-    if(rastate.scanmedia) {
-
-      //set transfer flag
-      transfer = 1;
-
-      //set gap period delay
-      gapperiod = 14000;
-
-      //fill both of the buffers now!
-      fillbuffer = 1 | 2;
-      //fill them here!
-
-      //setup data transferring variables
-      curbuffer = 0;
-      bufferpos = 0;
-
-      //prime outbyte with data
-      outbyte = buffer[curbuffer][bufferpos++];
+  //if we are sending/recieving data, tell main loop to not do anything!
+  if(transfer || writing)
+    return(1);
 
-      //tell main loop we need all cpu we can get
-      return(1);
+  //the motor stopped.  save what was written, a run of pages at a time so a
+  //transfer starting again waits for one at most, then prime the ring at the
+  //start of the side for the next one.
+  if(armed == 0 && state != RA_TRANSFER) {
+    if(writeback_pending())
+      writeback_flush();
+    else {
+      image_rewind();
+      cli();
+      if(state == RA_STOPPING)
+        state = RA_IDLE;
+      control();
+      sei();
     }
   }
 
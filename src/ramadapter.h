@@ -4,6 +4,30 @@
 
 #include "types.h"
 
+//set to 1 (in the makefile) to send read data with usart1 in spi master mode
+//instead of the timer1 interrupt
+#ifndef RA_USART
+#define RA_USART        0
+#endif
+
+//set to 1 (in the makefile) to take the inputs from the ram adapter on pin
+//change interrupts, see ramadapter.c
+#ifndef RA_PCINT
+#define RA_PCINT        0
+#endif
+
+//control states
+#define RA_IDLE         0
+#define RA_SPINUP       1
+#define RA_READY        2
+#define RA_TRANSFER     3
+#define RA_STOPPING     4
+
+//bit rate the ram adapter expects, and how far off it can be in percent
+#define RA_RATE_NOMINAL 96400UL
+#define RA_RATE_MIN     100
+#define RA_RATE_MAX     110
+
 typedef struct rastate_s {
 
   //outputs to ram adapter
@@ -18,14 +42,29 @@ typedef struct rastate_s {
   u8 write;
 } rastate_t;
 
-extern rastate_t rastate;
+extern volatile rastate_t rastate;
+
+struct fat_file_struct;
 
 void ramadapter_init(void);
+void ramadapter_release(void);
+void *ramadapter_borrow(u16 size);
 void ramadapter_mediaset(u8 state);
 void ramadapter_motoron(u8 state);
 void ramadapter_ready(u8 state);
 void ramadapter_rwmedia(u8 state);
 void ramadapter_poll(void);
 u8 ramadapter_tick(void);
+void ramadapter_image(struct fat_file_struct *fd);
+u8 ramadapter_flashimage(u8 n);
+u8 ramadapter_sides(void);
+u8 ramadapter_curside(void);
+void ramadapter_side(u8 n);
+u16 ramadapter_underruns(void);
+u8 ramadapter_writefails(void);
+u8 ramadapter_state(void);
+void ramadapter_setrate(u8 percent);
+u8 ramadapter_rate(void);
+u32 ramadapter_ratehz(void);
 
 #endif
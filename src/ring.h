@@ -0,0 +1,126 @@
+#ifndef __ring_h__
+#define __ring_h__
+
+/*
+Ring of 256 byte slots between an interrupt handler and the main loop.  One
+side moves single bytes (the handler), the other whole slots (the main loop,
+reading or writing the sd card), in either direction.
+
+The producer owns head and put, the consumer owns tail and got, so neither
+side has to disable interrupts.  put - got is the number of full slots, at
+most RING_SLOTS - 1 so the slot being filled is never the one being drained.
+
+  overruns    producer had a full slot and nowhere to go, the slot is reused
+              and its data is lost
+  underruns   consumer wanted a byte and the ring was empty
+  highwater   most full slots waiting at one time
+*/
+
+#include "types.h"
+
+//number of slots, set in the makefile to trade sram for sd latency
+#ifndef RING_SLOTS
+#define RING_SLOTS      4
+#endif
+
+#if RING_SLOTS < 2 || RING_SLOTS > 32
+#error RING_SLOTS must be from 2 to 32
+#endif
+
+typedef struct ring_s {
+  u8 slot[RING_SLOTS][256];
+
+  //producer side: slot being filled, position in it and slots filled
+  u8 head;
+  u8 wpos;
+  u8 put;
+
+  //consumer side: oldest full slot, position in it and slots drained
+  u8 tail;
+  u8 rpos;
+  u8 got;
+
+  u8 highwater;
+  u16 overruns;
+  u16 underruns;
+} ring_t;
+
+static inline void ring_init(volatile ring_t *r)
+{
+  r->head = r->wpos = r->put = 0;
+  r->tail = r->rpos = r->got = 0;
+  r->highwater = 0;
+  r->overruns = 0;
+  r->underruns = 0;
+}
+
+//number of full slots waiting for the consumer
+static inline u8 ring_used(volatile ring_t *r)
+{
+  return((u8)(r->put - r->got));
+}
+
+//producer: the slot being filled is complete, move on to the next
+static inline void ring_commit(volatile ring_t *r)
+{
+  u8 used = ring_used(r);
+
+  if(used >= RING_SLOTS - 1) {
+    r->overruns++;
+    return;
+  }
+  if(++r->head == RING_SLOTS)
+    r->head = 0;
+  r->put++;
+  if(used + 1 > r->highwater)
+    r->highwater = used + 1;
+}
+
+//producer: add one byte
+static inline void ring_putbyte(volatile ring_t *r, u8 data)
+{
+  r->slot[r->head][r->wpos] = data;
+  if(++r->wpos == 0)
+    ring_commit(r);
+}
+
+//producer: the slot to fill whole, or 0 if the ring is full
+static inline volatile u8 *ring_free(volatile ring_t *r)
+{
+  if(ring_used(r) >= RING_SLOTS - 1)
+    return(0);
+  return(r->slot[r->head]);
+}
+
+//consumer: the oldest full slot, or 0 if there is none
+static inline volatile u8 *ring_full(volatile ring_t *r)
+{
+  if(ring_used(r) == 0)
+    return(0);
+  return(r->slot[r->tail]);
+}
+
+//consumer: done with the oldest full slot
+static inline void ring_release(volatile ring_t *r)
+{
+  if(++r->tail == RING_SLOTS)
+    r->tail = 0;
+  r->got++;
+}
+
+//consumer: take one byte, 0 if the ring is empty
+static inline u8 ring_getbyte(volatile ring_t *r)
+{
+  u8 data;
+
+  if(ring_used(r) == 0) {
+    r->underruns++;
+    return(0);
+  }
+  data = r->slot[r->tail][r->rpos];
+  if(++r->rpos == 0)
+    ring_release(r);
+  return(data);
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include <avr/io.h>
+#include <string.h>
+#include "sdbench.h"
+#include "diskdrive.h"
+#include "../lib/sd-reader/sd_raw.h"
+
+//timer3 clock while timing, 64us a tick
+#define SDBENCH_CLOCK   (F_CPU / 1024)
+
+static struct fat_fs_struct *benchfs;
+static struct fat_dir_struct *benchroot;
+
+void sdbench_init(struct fat_fs_struct *fs, struct fat_dir_struct *root)
+{
+  benchfs = fs;
+  benchroot = root;
+}
+
+//a whole card block, too big for the stack under the menu and sd calls.  the
+//first two slots of the capture ring are used, it is idle while the menu is
+//up (writes are only captured while the ram adapter has the main loop).
+#define SDBENCH_BLOCK   512
+
+//time writing or reading len bytes of the card from offset, in timer ticks,
+//0 on an error
+static u16 timeblocks(offset_t offset, u32 len, u8 write)
+{
+  u8 *buf = (u8*)decoder.ring.slot[0];
+  u16 start;
+  u32 i;
+
+  memset(buf,0x55,SDBENCH_BLOCK);
+  start = TCNT3;
+  for(i = 0; i < len; i += SDBENCH_BLOCK) {
+    if(write) {
+      if(sd_raw_write(offset + i,buf,SDBENCH_BLOCK) == 0)
+        return(0);
+    }
+    else if(sd_raw_read(offset + i,buf,SDBENCH_BLOCK) == 0)
+      return(0);
+  }
+  if(write && sd_raw_sync() == 0)
+    return(0);
+  return(TCNT3 - start);
+}
+
+//find the blocks of the benchmark file, making it if it is not there
+static u8 findblocks(offset_t *offset, u32 *len)
+{
+  struct fat_dir_entry_struct de;
+  struct fat_file_struct *fd;
+  u8 ok;
+
+  if(benchfs == 0)
+    return(0);
+  fat_reset_dir(benchroot);
+  ok = fat_create_file(benchroot,SDBENCH_NAME,&de);
+  fat_reset_dir(benchroot);
+  if(ok == 0)
+    return(0);
+  de.attributes |= FAT_ATTRIB_HIDDEN;
+  if((fd = fat_open_file(benchfs,&de)) == 0)
+    return(0);
+  ok = fat_resize_file(fd,SDBENCH_SIZE) && fat_get_file_extent(fd,offset,len);
+  fat_close_file(fd);
+  sd_raw_sync();
+
+  //whole blocks only
+  *len &= ~511UL;
+  return(ok && *len);
+}
+
+//run the benchmark, returns 0 if the card could not be written or read
+u8 sdbench_run(sdbench_t *r)
+{
+  u8 tccr3a = TCCR3A, tccr3b = TCCR3B, timsk3 = TIMSK3;
+  offset_t offset;
+  u32 len;
+  u16 w, rd;
+  u8 mode, ok = 1;
+
+  memset(r,0,sizeof(sdbench_t));
+  if(findblocks(&offset,&len) == 0)
+    return(0);
+
+  //timer3 is borrowed from the ram adapter and the disk drive
+  TIMSK3 = 0;
+  TCCR3A = 0;
+  TCCR3B = 0x05;        //div by 1024
+
+  for(mode = SD_RAW_BENCH ? 0 : 1; mode < 2; mode++) {
+#if SD_RAW_BENCH
+    sd_raw_spi_bytewise(mode == 0);
+#endif
+    if((w = timeblocks(offset,len,1)) == 0 || (rd = timeblocks(offset,len,0)) == 0) {
+      ok = 0;
+      break;
+    }
+    r->write[mode] = len * SDBENCH_CLOCK / w;
+    r->read[mode] = len * SDBENCH_CLOCK / rd;
+  }
+#if SD_RAW_BENCH
+  sd_raw_spi_bytewise(0);
+#endif
+
+  TCCR3B = 0;
+  TCCR3A = tccr3a;
+  TIMSK3 = timsk3;
+  TCCR3B = tccr3b;
+  return(ok);
+}
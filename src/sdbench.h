@@ -0,0 +1,28 @@
+#ifndef __sdbench_h__
+#define __sdbench_h__
+
+#include "types.h"
+#include "../lib/sd-reader/fat.h"
+
+/*
+SD card benchmark.  Blocks are written to a hidden file of their own in the
+root directory and read back, once moved byte by byte as sd_raw did before
+its block loops and once with the block loops, timed with timer3.  Writes
+include the sync at the end, reads are sequential so they stream.
+*/
+
+#define SDBENCH_NAME        "sdbench.bin"
+
+//bytes written and read in each pass, less if the file is not contiguous
+#define SDBENCH_SIZE        32768UL
+
+//bytes per second, [0] byte by byte, [1] with the block loops
+typedef struct sdbench_s {
+  u32 read[2];
+  u32 write[2];
+} sdbench_t;
+
+void sdbench_init(struct fat_fs_struct *fs, struct fat_dir_struct *root);
+u8 sdbench_run(sdbench_t *r);
+
+#endif
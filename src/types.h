@@ -1,12 +1,14 @@
 #ifndef __types_h__
 #define __types_h__
 
-typedef unsigned char   u8;
-typedef unsigned short  u16;
-typedef unsigned int    u32;
+#include <stdint.h>
 
-typedef signed char     s8;
-typedef signed short    s16;
-typedef signed int      s32;
+typedef uint8_t         u8;
+typedef uint16_t        u16;
+typedef uint32_t        u32;
+
+typedef int8_t          s8;
+typedef int16_t         s16;
+typedef int32_t         s32;
 
 #endif
@@ -0,0 +1,348 @@
+#include <string.h>
+#include "writeback.h"
+#include "fds.h"
+#include "crc.h"
+#include "../lib/sd-reader/fat.h"
+#include "../lib/sd-reader/sd_raw.h"
+
+//a page of the image with written blocks in it
+typedef struct wbpage_s {
+  u32 offset;     //image offset of data[0], a multiple of WB_PAGESIZE
+  u16 len;        //bytes of the image in data, less at the end of the file
+  u8 used;
+  u16 first;      //block it was taken for, see dropblock
+  u8 data[WB_PAGESIZE];
+} wbpage_t;
+
+static struct fat_file_struct *image;
+static wbpage_t page[WB_PAGES];
+
+//page the last byte went to
+static wbpage_t *cur;
+
+//block being written: image offset of its next byte and of its first, type,
+//position in it, length (crc not included) and crc so far, and a number
+//told apart from the blocks before it
+static u32 offset, blockstart;
+static u8 type;
+static u16 pos, len, crc;
+static u16 serial;
+
+//file size from the last file header block written
+static u16 filesize;
+
+//image offset just past the last block written, the blocks written and how
+//many failed the crc check
+static u32 end;
+static u8 blocks, crcerrors;
+
+//set when a block of the write did not fit, the rest of the write is
+//refused until the next one starts
+static u8 failed;
+
+//the image file is shared with the playback, its position is put back
+//after every access, with its cluster so the chain is not walked again
+static uint32_t savedpos;
+static cluster_t savedcluster;
+
+static void savepos(void)
+{
+  int32_t at = 0;
+
+  savedcluster = 0;
+  if(fat_tell_file(image, &savedpos, &savedcluster) == 0) {
+    fat_seek_file(image, &at, FAT_SEEK_CUR);
+    savedpos = at;
+  }
+}
+
+static void restorepos(void)
+{
+  fat_seek_file_cluster(image, savedpos, savedcluster);
+}
+
+static void seekto(int32_t at)
+{
+  fat_seek_file(image, &at, FAT_SEEK_SET);
+}
+
+//page holding offset at, 0 if there is none
+static wbpage_t *findpage(u32 at)
+{
+  u8 i;
+
+  for(i = 0; i < WB_PAGES; i++) {
+    if(page[i].used && page[i].offset == at)
+      return(&page[i]);
+  }
+  return(0);
+}
+
+//page with the lowest offset, 0 if there is none
+static wbpage_t *lowestpage(void)
+{
+  wbpage_t *low = 0;
+  u8 i;
+
+  for(i = 0; i < WB_PAGES; i++) {
+    if(page[i].used && (low == 0 || page[i].offset < low->offset))
+      low = &page[i];
+  }
+  return(low);
+}
+
+//page for offset at, read in from the image if it is not held yet.  0 if all
+//the pages are in use, they are only saved once the motor stops, never in
+//the middle of a transfer.
+static wbpage_t *getpage(u32 at)
+{
+  wbpage_t *p;
+  intptr_t n;
+  u8 i;
+
+  at &= ~(u32)(WB_PAGESIZE - 1);
+  if((p = findpage(at)) != 0)
+    return(p);
+
+  for(i = 0; i < WB_PAGES; i++) {
+    if(page[i].used == 0)
+      break;
+  }
+  if(i == WB_PAGES)
+    return(0);
+  p = &page[i];
+
+  savepos();
+  seekto(at);
+  n = fat_read_file(image, p->data, WB_PAGESIZE);
+  restorepos();
+
+  p->offset = at;
+  p->len = (n > 0) ? n : 0;
+  p->used = 1;
+  p->first = serial;
+  return(p);
+}
+
+/*
+Take the block being written back out of the pages, so no part of it is ever
+saved.  A page taken for it holds nothing else and is let go, in a page that
+held an earlier block the bytes it covered are read back from the image.
+*/
+static void dropblock(void)
+{
+  u8 i;
+
+  for(i = 0; i < WB_PAGES; i++) {
+    wbpage_t *p = &page[i];
+    u32 from, to;
+
+    if(p->used == 0)
+      continue;
+    if(p->first == serial) {
+      p->used = 0;
+      continue;
+    }
+    from = (p->offset > blockstart) ? p->offset : blockstart;
+    to = p->offset + p->len;
+    if(to > offset)
+      to = offset;
+    if(from >= to)
+      continue;
+    savepos();
+    seekto(from);
+    fat_read_file(image, &p->data[from - p->offset], to - from);
+    restorepos();
+  }
+  cur = 0;
+  failed = 1;
+  pos = 0;
+}
+
+//patch one byte of a block into its page, bytes past the end of the image
+//are dropped.  returns 0 if there is no page for it.
+static u8 putbyte(u8 b)
+{
+  u16 i = offset & (WB_PAGESIZE - 1);
+
+  if(cur == 0 || cur->used == 0 || cur->offset != (offset & ~(u32)(WB_PAGESIZE - 1)))
+    cur = getpage(offset);
+  if(cur == 0)
+    return(0);
+  if(i < cur->len)
+    cur->data[i] = b;
+  offset++;
+  return(1);
+}
+
+//set the image written blocks go to, anything held for the last one is
+//dropped, so flush it first
+void writeback_open(struct fat_file_struct *fd)
+{
+  image = fd;
+  memset(page, 0, sizeof(page));
+  cur = 0;
+  pos = 0;
+  filesize = 0;
+  end = 0;
+  blocks = 0;
+  crcerrors = 0;
+  failed = 0;
+}
+
+/*
+A write is starting, its first block goes to image offset at.  filesize is
+the one in effect there for a file data block.  If append is set the write is
+past the last block of the side, and carries on after a block appended
+earlier if there is one.  Returns the file size the decoder should use.
+*/
+u16 writeback_start(u32 at, u16 size, u8 append)
+{
+  if(append && end > at)
+    at = end;
+  else
+    filesize = size;
+  offset = at;
+  pos = 0;
+  failed = 0;
+  return(filesize);
+}
+
+/*
+Feed decoded bytes of the write, blocks back to back with their crc as the
+decoder gives them.  The block data is patched into the pages, the crc is
+only checked, a bad one is counted but the data is kept as a disk would.  A
+block that does not fit in the pages is taken back out whole and the rest of
+the write is refused.  Returns 0 if there is no image or the write failed.
+*/
+u8 writeback_data(const u8 *data, u16 n)
+{
+  u16 i;
+
+  if(image == 0 || failed)
+    return(0);
+
+  for(i = 0; i < n; i++) {
+    u8 b = data[i];
+
+    //start of a block, a byte that is not one is dropped
+    if(pos == 0) {
+      type = b;
+      len = fds_blocksize(b, filesize);
+      if(len == 0)
+        continue;
+      crc = FDS_CRC_INIT;
+      blockstart = offset;
+      serial++;
+    }
+
+    //remember the file size for the following data block
+    if(type == FDS_FILEHEADER) {
+      if(pos == FDS_FILESIZE_POS)
+        filesize = b;
+      else if(pos == FDS_FILESIZE_POS + 1)
+        filesize |= (u16)b << 8;
+    }
+
+    crc = crc_byte(crc, b);
+    if(pos++ < len) {
+      if(putbyte(b) == 0) {
+        dropblock();
+        return(0);
+      }
+    }
+
+    //last crc byte, the crc of the block and its crc comes out as 0
+    else if(pos == len + 2) {
+      blocks++;
+      if(crc != 0)
+        crcerrors++;
+      end = offset;
+      pos = 0;
+    }
+  }
+  return(1);
+}
+
+//the write has ended, a block it left unfinished is taken back out.
+//returns 0 if the write failed.
+u8 writeback_end(void)
+{
+  if(image == 0 || failed)
+    return(0);
+  if(pos) {
+    dropblock();
+    return(0);
+  }
+  return(1);
+}
+
+//lay the held pages over len bytes of the image read from offset at
+void writeback_patch(u32 at, u8 *data, u16 n)
+{
+  u8 i;
+
+  for(i = 0; i < WB_PAGES; i++) {
+    wbpage_t *p = &page[i];
+    u32 from, to;
+
+    if(p->used == 0)
+      continue;
+    from = (p->offset > at) ? p->offset : at;
+    to = p->offset + p->len;
+    if(to > at + n)
+      to = at + n;
+    if(from < to)
+      memcpy(&data[from - at], &p->data[from - p->offset], to - from);
+  }
+}
+
+//number of pages waiting to be saved
+u8 writeback_pending(void)
+{
+  u8 i, n = 0;
+
+  for(i = 0; i < WB_PAGES; i++)
+    n += page[i].used;
+  return(n);
+}
+
+/*
+Save the run of consecutive pages with the lowest offset, with one seek.
+Called a run at a time once the motor has stopped, so the main loop (and a
+transfer starting again) never waits for more than one.  Returns 1 if there
+are pages left.
+*/
+u8 writeback_flush(void)
+{
+  wbpage_t *p = lowestpage();
+
+  if(p == 0)
+    return(0);
+
+  savepos();
+  seekto(p->offset);
+  while(p) {
+    u32 next = p->offset + WB_PAGESIZE;
+
+    fat_write_file(image, p->data, p->len);
+    p->used = 0;
+    p = findpage(next);
+  }
+  restorepos();
+
+  if(writeback_pending())
+    return(1);
+  sd_raw_sync();
+  return(0);
+}
+
+u8 writeback_blocks(void)
+{
+  return(blocks);
+}
+
+u8 writeback_crcerrors(void)
+{
+  return(crcerrors);
+}
@@ -0,0 +1,37 @@
+#ifndef __writeback_h__
+#define __writeback_h__
+
+#include "types.h"
+
+/*
+Blocks written by the ram adapter, held in ram until the motor stops.  The
+written blocks are patched into pages of the image, read in from the sd card
+as they are first written to, and the pages are written back in order of
+their offset, each run of consecutive pages with one seek.  Until then the
+pages are laid over the image as it is played back (writeback_patch), so the
+disk reads back what was written before it is saved.
+*/
+
+//pages of the image held, set in the makefile to trade sram for how much can
+//be written before the motor stops.  a block that does not fit is taken out
+//whole and the write fails (writeback_data returns 0), the pages are never
+//saved mid transfer.
+#ifndef WB_PAGES
+#define WB_PAGES        4
+#endif
+
+#define WB_PAGESIZE     256
+
+struct fat_file_struct;
+
+void writeback_open(struct fat_file_struct *fd);
+u16 writeback_start(u32 offset, u16 filesize, u8 append);
+u8 writeback_data(const u8 *data, u16 len);
+u8 writeback_end(void);
+void writeback_patch(u32 offset, u8 *data, u16 len);
+u8 writeback_pending(void);
+u8 writeback_flush(void);
+u8 writeback_blocks(void);
+u8 writeback_crcerrors(void);
+
+#endif
@@ -0,0 +1,153 @@
+/*
+crcbench - check the table driven fds crc against the bitwise one, and time
+them.
+
+usage: crcbench [megabytes]
+
+Both table sizes are built in (crc.c is compiled twice by the makefile).
+Each is checked against fixed crcs of known data and against the bitwise
+routine on random data, then all three are timed over the given amount of
+data (default 64mb).  Returns 1 if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+
+u16 crc_update256(u16 crc, const u8 *data, u16 len);
+u16 crc_update16(u16 crc, const u8 *data, u16 len);
+
+//the original, from the nesdev board.  thanks bisquit
+static u16 updatecrc(u16 crc, u8 data)
+{
+  u8 c;
+  int n;
+
+  for(n = 0x01; n <= 0x80; n = n << 1) {
+    c = (u8)(crc & 1);
+    crc >>= 1;
+    if(c)
+      crc = crc ^ 0x8408;
+    if(data & n)
+      crc = crc ^ 0x8000;
+  }
+  return(crc);
+}
+
+static u16 crc_bitwise(u16 crc, const u8 *data, u16 len)
+{
+  while(len--)
+    crc = updatecrc(crc, *data++);
+  return(crc);
+}
+
+typedef u16 (*crcfunc_t)(u16 crc, const u8 *data, u16 len);
+
+static const struct {
+  const char *name;
+  crcfunc_t func;
+} kernels[] = {
+  {"bitwise",   crc_bitwise},
+  {"table 256", crc_update256},
+  {"table 16",  crc_update16},
+};
+
+#define NUMKERNELS ((int)(sizeof(kernels) / sizeof(kernels[0])))
+
+//crcs from 0x8000, the second with the two 0 bytes that make it the crc
+//stored after a block
+static const struct {
+  const char *data;
+  u16 len;
+  u16 crc, stored;
+} golden[] = {
+  {"",                      0,  0x8000, 0x8408},
+  {"\x00",                  1,  0x0080, 0x8CCC},
+  {"\x02\x01",              2,  0x850A, 0x2ED5},
+  {"\x01*NINTENDO-HVC*",    15, 0x0860, 0xE91D},
+};
+
+#define NUMGOLDEN ((int)(sizeof(golden) / sizeof(golden[0])))
+
+static int check(int k)
+{
+  static u8 buf[4096];
+  int i, fails = 0;
+
+  for(i = 0; i < NUMGOLDEN; i++) {
+    u16 crc = kernels[k].func(0x8000, (const u8*)golden[i].data, golden[i].len);
+    u16 stored = kernels[k].func(crc, (const u8*)"\0\0", 2);
+
+    if(crc != golden[i].crc || stored != golden[i].stored) {
+      printf("%s: vector %d gives %04X/%04X, expected %04X/%04X\n", kernels[k].name,
+        i, crc, stored, golden[i].crc, golden[i].stored);
+      fails++;
+    }
+  }
+
+  //the crc of a block followed by its stored crc comes out as 0
+  srand(1);
+  for(i = 0; i < 1000; i++) {
+    u16 len = rand() % (sizeof(buf) - 2), crc, n;
+
+    for(n = 0; n < len; n++)
+      buf[n] = rand();
+    crc = kernels[k].func(0x8000, buf, len);
+    if(crc != crc_bitwise(0x8000, buf, len)) {
+      printf("%s: random block %d does not match the bitwise crc\n", kernels[k].name, i);
+      fails++;
+      break;
+    }
+    crc = kernels[k].func(crc, (const u8*)"\0\0", 2);
+    buf[len] = (u8)crc;
+    buf[len + 1] = (u8)(crc >> 8);
+    if(kernels[k].func(0x8000, buf, len + 2) != 0) {
+      printf("%s: random block %d does not check out as 0\n", kernels[k].name, i);
+      fails++;
+      break;
+    }
+  }
+  return(fails);
+}
+
+int main(int argc, char *argv[])
+{
+  static u8 buf[65500];
+  long megabytes = 64, bytes, done;
+  struct timespec start, end;
+  int k, fails = 0;
+  u16 crc;
+  double ns;
+
+  if(argc > 1)
+    megabytes = atol(argv[1]);
+  if(megabytes <= 0) {
+    fprintf(stderr, "usage: %s [megabytes]\n", argv[0]);
+    return(2);
+  }
+  bytes = megabytes << 20;
+
+  for(k = 0; k < NUMKERNELS; k++)
+    fails += check(k);
+  printf("check: %s\n", fails ? "failed" : "ok, all kernels match the golden and bitwise crcs");
+
+  for(k = 0; k < (int)sizeof(buf); k++)
+    buf[k] = rand();
+
+  for(k = 0; k < NUMKERNELS; k++) {
+    crc = 0x8000;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(done = 0; done < bytes; done += sizeof(buf))
+      crc = kernels[k].func(crc, buf, sizeof(buf));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    ns /= done;
+    printf("%-10s %6.2f ns per byte, %7.1f mb/s  (crc %04X)\n", kernels[k].name,
+      ns, 1e3 / ns, crc);
+  }
+
+  return(fails ? 1 : 0);
+}
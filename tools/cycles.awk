@@ -0,0 +1,205 @@
+# cycles.awk - worst case cycle count of an avr interrupt handler
+#
+# usage: avr-objdump -d main.elf | awk -v isr=__vector_5 -v budget=166 [-v f_cpu=16000000] [-v strict=0] -f cycles.awk
+#
+# Walks every path through the handler's disassembly, from its label to the
+# point where the next interrupt can be taken, and prints the longest one.
+# That is a reti, or a sei in a function it calls (capture_byte lets the next
+# edge in before it decodes).  Calls are followed into the callee, which is
+# walked the same way: paths through it that return carry on after the call,
+# paths that reach a sei end there.  The interrupt response and the jmp in
+# the vector table are added.  Exits with 1 if the longest path is over
+# budget, unless strict is 0, then it only warns.  A loop, an indirect jump
+# or call, or a jump out of the disassembly can not be bounded and also
+# fails.
+#
+# An edge comes at most once per bit cell, so the worst case is also the cost
+# of a bit, and f_cpu over it is the highest bit rate the handler sustains.
+
+function cost(op)
+{
+  if(op ~ /^(push|pop|ld|ldd|st|std|lds|sts|adiw|sbiw|rjmp|ijmp|cbi|sbi)$/) return 2
+  if(op ~ /^(mul|muls|mulsu|fmul|fmuls|fmulsu)$/) return 2
+  if(op ~ /^(jmp|rcall|icall|lpm|elpm)$/) return 3
+  if(op ~ /^(call|ret|reti)$/) return 4
+  return 1
+}
+
+function max(a, b)
+{
+  return (a > b) ? a : b
+}
+
+function fail(i, why)
+{
+  printf("%s: %s at 0x%x in %s, can not bound it\n", isr, why, addr[i], fn[i]) > "/dev/stderr"
+  failed = 1
+}
+
+# longest paths from instruction i: en[i] to where interrupts are on again,
+# rt[i] to a ret back to the caller, -1 if there is none
+function walk(i,    o, j, k, c, n, t)
+{
+  if(i in en)
+    return
+  if(i in busy) {
+    fail(i, "loop")
+    en[i] = rt[i] = -1
+    return
+  }
+  busy[i] = 1
+  o = op[i]
+  en[i] = rt[i] = -1
+
+  if(o == "reti" || o == "sei") {
+    en[i] = cost(o)
+    delete busy[i]
+    return
+  }
+  if(o == "ret") {
+    rt[i] = cost(o)
+    delete busy[i]
+    return
+  }
+  if(o ~ /^(icall|eicall|ijmp|eijmp)$/) {
+    fail(i, "indirect " o)
+    delete busy[i]
+    return
+  }
+
+  # a call: through the callee, and on after it if the callee returns
+  if(o == "call" || o == "rcall") {
+    c = cost(o)
+    if((t = index_of(i, target[i])) < 0) {
+      delete busy[i]
+      return
+    }
+    called[fn[t]] = 1
+    walk(t)
+    walk(i + 1)
+    if(en[t] >= 0)
+      en[i] = c + en[t]
+    if(rt[t] >= 0 && en[i + 1] >= 0)
+      en[i] = max(en[i], c + rt[t] + en[i + 1])
+    if(rt[t] >= 0 && rt[i + 1] >= 0)
+      rt[i] = c + rt[t] + rt[i + 1]
+    delete busy[i]
+    return
+  }
+
+  # successors, with the cycles it takes to get to each
+  n = 0
+  if(o ~ /^br..$/) {
+    succ[i, ++n] = i + 1;       scost[i, n] = 1
+    succ[i, ++n] = index_of(i, target[i]); scost[i, n] = 2
+  }
+  else if(o ~ /^(cpse|sbrc|sbrs|sbic|sbis)$/) {
+    succ[i, ++n] = i + 1;       scost[i, n] = 1
+    succ[i, ++n] = i + 2;       scost[i, n] = (words[i + 1] == 2) ? 3 : 2
+  }
+  else if(o == "rjmp" || o == "jmp") {
+    succ[i, ++n] = index_of(i, target[i]); scost[i, n] = cost(o)
+  }
+  else {
+    succ[i, ++n] = i + 1;       scost[i, n] = cost(o)
+  }
+
+  for(k = 1; k <= n; k++) {
+    j = succ[i, k]
+    c = scost[i, k]
+    if(j < 0 || j >= count) {
+      if(j >= count)
+        fail(i, "end of the disassembly")
+      continue
+    }
+    walk(j)
+    if(en[j] >= 0)
+      en[i] = max(en[i], c + en[j])
+    if(rt[j] >= 0)
+      rt[i] = max(rt[i], c + rt[j])
+  }
+  delete busy[i]
+}
+
+function hex(s,    i, n)
+{
+  n = 0
+  for(i = 1; i <= length(s); i++)
+    n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+  return n
+}
+
+# instruction at an address, jumps and calls from i may go to any function
+function index_of(i, a)
+{
+  if(a in at)
+    return at[a]
+  fail(i, sprintf("jump to 0x%x", a))
+  return -1
+}
+
+BEGIN {
+  if(budget == "")
+    budget = 166
+  if(strict == "")
+    strict = 1
+  if(f_cpu == "")
+    f_cpu = 16000000
+  if(entry == "")
+    entry = 8         # 5 cycle interrupt response + jmp in the vector table
+  count = 0
+}
+
+# start of a function
+/^[0-9a-f]+ <.*>:$/ {
+  name = $2
+  gsub(/[<>:]/, "", name)
+  start[name] = count
+  next
+}
+
+name != "" && /^ +[0-9a-f]+:\t/ {
+  split($0, f, "\t")
+  a = f[1]
+  gsub(/[ :]/, "", a)
+  a = hex(a)
+  b = f[2]
+  gsub(/ +$/, "", b)
+  i = count++
+  addr[i] = a
+  at[a] = i
+  fn[i] = name
+  words[i] = split(b, tmp, " ") / 2
+  op[i] = f[3]
+  target[i] = -1
+  if(match($0, /; 0x[0-9a-f]+/))
+    target[i] = hex(substr($0, RSTART + 4, RLENGTH - 4))
+}
+
+END {
+  if(!(isr in start)) {
+    printf("%s: not found\n", isr) > "/dev/stderr"
+    exit 1
+  }
+  walk(start[isr])
+  worst = en[start[isr]]
+  if(worst < 0) {
+    printf("%s: no path to a reti\n", isr) > "/dev/stderr"
+    exit 1
+  }
+
+  calls = ""
+  for(c in called)
+    calls = calls " " c
+  printf("%s: worst case %d cycles per edge (%d entry + %d), budget %d, headroom %d\n",
+    isr, entry + worst, entry, worst, budget, budget - entry - worst)
+  if(calls != "")
+    printf("%s: callees included:%s\n", isr, calls)
+  printf("%s: sustains up to %d bit/s (%d hz / %d cycles), %.2fx the 96400 bit/s of the disk\n",
+    isr, f_cpu / (entry + worst), f_cpu, entry + worst, f_cpu / (entry + worst) / 96400)
+  if(failed || entry + worst > budget) {
+    if(strict)
+      exit 1
+    printf("%s: warning: over budget, only checked with CAPTURE_ASM=1\n", isr) > "/dev/stderr"
+  }
+}
@@ -0,0 +1,217 @@
+/*
+fluxreplay - run a flux dump back through the read data decoder on the host.
+
+usage: fluxreplay [-m bits|fds] [-f] [-o out.bin] dump.flx [expected.bin]
+
+The intervals in dump.flx (see src/decoder.h for the format) are fed through
+decoder_edge() in bit mode (or fds block mode with -m fds, the output is then
+the blocks with their crcs, as fed to the .fds image writer), exactly as the
+read data interrupt would.  -f turns off clock recovery and decodes with the
+fixed BIT_THRESHOLD.  The decoded bytes are written to out.bin and/or
+compared against expected.bin.
+
+Whether the decoder keeps up on the device is a question of avr cycles per
+edge, not host time.  tools/cycles.awk (make cycles in the top directory)
+reports the cost per bit and the highest bit rate it sustains.
+
+Packed runs are replayed as count intervals of the longest interval in the
+run, which decodes the same as long as the threshold is above it.  With clock
+recovery on they pull the cell period up a little, the raw intervals that
+follow every run bring it back.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decoder.h"
+
+static u8 *intervals;
+static long numintervals, maxintervals;
+
+static void addinterval(u8 time)
+{
+  if(numintervals == maxintervals) {
+    maxintervals = maxintervals ? maxintervals * 2 : 65536;
+    if((intervals = realloc(intervals, maxintervals)) == 0) {
+      fprintf(stderr, "out of memory\n");
+      exit(2);
+    }
+  }
+  intervals[numintervals++] = time;
+}
+
+//read the dump and expand it into one byte per interval
+static int loadflux(const char *filename, fluxhdr_t *hdr)
+{
+  FILE *fp;
+  int c;
+
+  if((fp = fopen(filename, "rb")) == 0) {
+    perror(filename);
+    return(0);
+  }
+  if(fread(hdr, sizeof(*hdr), 1, fp) != 1 || memcmp(hdr->ident, "FLX\x1a", 4) != 0) {
+    fprintf(stderr, "%s: not a flux dump\n", filename);
+    fclose(fp);
+    return(0);
+  }
+  if(hdr->version != FLUX_VERSION)
+    fprintf(stderr, "%s: warning, version %d dump\n", filename, hdr->version);
+
+  while((c = fgetc(fp)) != EOF) {
+    if(c == 0x00) {
+      int lo = fgetc(fp), hi = fgetc(fp), max = fgetc(fp);
+      long count;
+
+      if(max == EOF) {
+        fprintf(stderr, "%s: truncated run record\n", filename);
+        break;
+      }
+      for(count = lo | (hi << 8); count; count--)
+        addinterval((u8)max);
+    }
+    else
+      addinterval((u8)c);
+  }
+  fclose(fp);
+  return(1);
+}
+
+static u8 mode = DUMP_BITS;
+static u8 track = 1;
+
+static u8 *output;
+static long outputlen;
+
+static void addoutput(volatile u8 *data, int len)
+{
+  if((output = realloc(output, outputlen + len)) == 0) {
+    fprintf(stderr, "out of memory\n");
+    exit(2);
+  }
+  memcpy(output + outputlen, (u8*)data, len);
+  outputlen += len;
+}
+
+//decode the whole trace into output
+static void decode(volatile decoder_t *d)
+{
+  volatile u8 *tail;
+  long i;
+  u8 len;
+
+  decoder_init(d, mode);
+  d->track = track;
+
+  //the device skips the leading gap with a timer, the dump has all of it
+  d->skip = SKIP_GAP_BITS;
+  for(i = 0; i < numintervals; i++) {
+    decoder_edge(d, intervals[i]);
+    if(ring_used(&d->ring)) {
+      addoutput(ring_full(&d->ring), 256);
+      ring_release(&d->ring);
+    }
+  }
+  tail = decoder_finish(d, &len);
+  if(len)
+    addoutput(tail, len);
+}
+
+static int compare(const char *filename)
+{
+  FILE *fp;
+  long i, size, diffs = 0, first = -1;
+  u8 *expect;
+
+  if((fp = fopen(filename, "rb")) == 0) {
+    perror(filename);
+    return(0);
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  expect = malloc(size ? size : 1);
+  if(fread(expect, 1, size, fp) != (size_t)size) {
+    fprintf(stderr, "%s: read error\n", filename);
+    fclose(fp);
+    return(0);
+  }
+  fclose(fp);
+
+  for(i = 0; i < size && i < outputlen; i++) {
+    if(expect[i] != output[i]) {
+      if(first < 0)
+        first = i;
+      diffs++;
+    }
+  }
+  free(expect);
+
+  if(size != outputlen)
+    printf("compare: length %ld, expected %ld\n", outputlen, size);
+  if(diffs)
+    printf("compare: %ld bytes differ, first at offset %ld\n", diffs, first);
+  if(size != outputlen || diffs)
+    return(0);
+  printf("compare: ok, %ld bytes match\n", size);
+  return(1);
+}
+
+int main(int argc, char *argv[])
+{
+  static decoder_t d;
+  const char *outname = 0, *dumpname = 0, *expectname = 0;
+  fluxhdr_t hdr;
+  long i;
+  int ret = 0;
+
+  for(i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      outname = argv[++i];
+    else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+      mode = strcmp(argv[++i], "fds") == 0 ? DUMP_FDS : DUMP_BITS;
+    else if(strcmp(argv[i], "-f") == 0)
+      track = 0;
+    else if(dumpname == 0)
+      dumpname = argv[i];
+    else if(expectname == 0)
+      expectname = argv[i];
+    else
+      dumpname = 0, i = argc;
+  }
+  if(dumpname == 0) {
+    fprintf(stderr, "usage: %s [-m bits|fds] [-f] [-o out.bin] dump.flx [expected.bin]\n", argv[0]);
+    return(2);
+  }
+
+  if(!loadflux(dumpname, &hdr))
+    return(2);
+  printf("%s: %ld intervals, timer clock %u hz, threshold 0x%02X\n",
+    dumpname, numintervals, (unsigned)hdr.clock, hdr.threshold);
+  if(hdr.overruns)
+    printf("warning: %u capture ring overruns, data was lost\n", hdr.overruns);
+  if(hdr.threshold != BIT_THRESHOLD)
+    printf("warning: decoder threshold is 0x%02X\n", BIT_THRESHOLD);
+
+  decode(&d);
+  printf("decoded %ld bytes, first gap ended at bit %ld\n", outputlen, d.outgap);
+  if(mode == DUMP_FDS)
+    printf("%d blocks\n", d.blocks);
+  if(track)
+    printf("recovered cell %.2f ticks, threshold 0x%02X\n", d.cell / 16.0, d.threshold);
+
+  if(outname) {
+    FILE *fp = fopen(outname, "wb");
+
+    if(fp == 0 || fwrite(output, 1, outputlen, fp) != (size_t)outputlen) {
+      perror(outname);
+      ret = 2;
+    }
+    if(fp)
+      fclose(fp);
+  }
+  if(expectname && !compare(expectname))
+    ret = 1;
+
+  return(ret);
+}